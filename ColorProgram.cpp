@@ -6,8 +6,8 @@
 Load< ColorProgram > color_program(LoadTagEarly);
 
 ColorProgram::ColorProgram() {
-	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
-	program = gl_compile_program(
+	//Compile vertex and fragment shaders using the convenient 'gl_submit_program' helper function:
+	program = gl_submit_program(
 		//vertex shader:
 		"#version 330\n"
 		"uniform mat4 OBJECT_TO_CLIP;\n"
@@ -26,16 +26,20 @@ ColorProgram::ColorProgram() {
 		"void main() {\n"
 		"	fragColor = color;\n"
 		"}\n"
-	);
-	//As you can see above, adjacent strings in C/C++ are concatenated.
-	// this is very useful for writing long shader programs inline.
+	,
+		//As you can see above, adjacent strings in C/C++ are concatenated.
+		// this is very useful for writing long shader programs inline.
 
-	//look up the locations of vertex attributes:
-	Position_vec4 = glGetAttribLocation(program, "Position");
-	Color_vec4 = glGetAttribLocation(program, "Color");
+		//once linked (see gl_finish_programs):
+		[this]() {
+			//look up the locations of vertex attributes:
+			Position_vec4 = glGetAttribLocation(program, "Position");
+			Color_vec4 = glGetAttribLocation(program, "Color");
 
-	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
+			//look up the locations of uniforms:
+			OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
+		}
+	);
 }
 
 ColorProgram::~ColorProgram() {
@@ -6,8 +6,8 @@
 Load< ColorTextureProgram > color_texture_program(LoadTagEarly);
 
 ColorTextureProgram::ColorTextureProgram() {
-	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
-	program = gl_compile_program(
+	//Compile vertex and fragment shaders using the convenient 'gl_submit_program' helper function:
+	program = gl_submit_program(
 		//vertex shader:
 		"#version 330\n"
 		"uniform mat4 OBJECT_TO_CLIP;\n"
@@ -31,25 +31,29 @@ ColorTextureProgram::ColorTextureProgram() {
 		"void main() {\n"
 		"	fragColor = texture(TEX, texCoord) * color;\n"
 		"}\n"
-	);
-	//As you can see above, adjacent strings in C/C++ are concatenated.
-	// this is very useful for writing long shader programs inline.
+	,
+		//As you can see above, adjacent strings in C/C++ are concatenated.
+		// this is very useful for writing long shader programs inline.
 
-	//look up the locations of vertex attributes:
-	Position_vec4 = glGetAttribLocation(program, "Position");
-	Color_vec4 = glGetAttribLocation(program, "Color");
-	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
+		//once linked (see gl_finish_programs):
+		[this]() {
+			//look up the locations of vertex attributes:
+			Position_vec4 = glGetAttribLocation(program, "Position");
+			Color_vec4 = glGetAttribLocation(program, "Color");
+			TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
 
-	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-	GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
+			//look up the locations of uniforms:
+			OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
+			GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
 
-	//set TEX to always refer to texture binding zero:
-	glUseProgram(program); //bind program -- glUniform* calls refer to this program now
+			//set TEX to always refer to texture binding zero:
+			glUseProgram(program); //bind program -- glUniform* calls refer to this program now
 
-	glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
+			glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
 
-	glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
+			glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
+		}
+	);
 }
 
 ColorTextureProgram::~ColorTextureProgram() {
@@ -7,6 +7,7 @@
 #include "Load.hpp"
 #include "gl_errors.hpp"
 #include "data_path.hpp"
+#include "read_write_chunk.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -39,22 +40,6 @@ Load< Scene > hexapod_scene(LoadTagDefault, []() -> Scene const * {
 	});
 });
 
-Load< Sound::Sample > Footsteps(LoadTagDefault, []() -> Sound::Sample const * {
-	return new Sound::Sample(data_path("Footsteps.opus"));
-});
-
-Load< Sound::Sample > EatSFX(LoadTagDefault, []() -> Sound::Sample const* {
-	return new Sound::Sample(data_path("Eat.opus"));
-});
-
-Load < Sound::Sample > WinSFX(LoadTagDefault, []() -> Sound::Sample const* {
-	return new Sound::Sample(data_path("Win.opus"));
-});
-
-Load < Sound::Sample > FailSFX(LoadTagDefault, []() -> Sound::Sample const* {
-	return new Sound::Sample(data_path("Fail.opus"));
-});
-
 GardenMode::GardenMode() : scene(*hexapod_scene) {
 
 	LoadGameObjects();
@@ -66,8 +51,35 @@ GardenMode::GardenMode() : scene(*hexapod_scene) {
 	light = &scene.lights.front();
 	assert(light != nullptr);
 
+	//the scene's light is passed to lit_color_texture_program by Scene::draw;
+	// make it the soft overhead hemisphere light this level is tuned for:
+	light->type = Scene::Light::Hemisphere;
+	light->energy = glm::vec3(1.0f, 1.0f, 0.95f);
+	light->transform->rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f); //pointing along -z
+
 	has_win_played = false;
 	has_lose_played = false;
+
+	//samples come from the shared cache, so any other mode using the same files shares their decoded data:
+	// (stored as 16-bit, which halves their memory use at no audible cost for sound effects)
+	footsteps_sample = Sound::get_sample(data_path("Footsteps.opus"), Sound::Sample::Int16);
+	eat_sample = Sound::get_sample(data_path("Eat.opus"), Sound::Sample::Int16);
+	win_sample = Sound::get_sample(data_path("Win.opus"), Sound::Sample::Int16);
+	fail_sample = Sound::get_sample(data_path("Fail.opus"), Sound::Sample::Int16);
+
+	//world sounds get a touch of garden ambience, are muffled while hidden, and duck under the win/fail stingers:
+	// (stinger_bus is made after world_bus so it is mixed first, and ducking doesn't lag a period)
+	world_bus = Sound::make_bus();
+	stinger_bus = Sound::make_bus();
+
+	world_muffle = std::make_shared< Sound::LowPass >();
+	world_bus->add_effect(world_muffle);
+	world_bus->add_effect(std::make_shared< Sound::Reverb >(0.3f, 0.6f, 0.15f));
+	auto duck = std::make_shared< Sound::Compressor >(0.05f, 8.0f, 0.01f, 0.5f);
+	duck->sidechain = stinger_bus;
+	world_bus->add_effect(duck);
+
+	save_state(&initial_state);
 }
 
 GardenMode::~GardenMode() {
@@ -77,14 +89,13 @@ void GardenMode::PlayAudio(AudioStatus as, bool to_start) {
 
 	if (as == AudioStatus::Footsteps) {
 		if (to_start)
-			footsteps = Sound::loop_3D(*Footsteps, 0.5f, get_foot_position(), 100.0f);
+			footsteps = Sound::loop_3D(*footsteps_sample, 0.5f, get_foot_position(), 100.0f, 0, world_bus);
 		else
 			footsteps->stop();
 	}
 	else if (as == AudioStatus::Eat) {
-		static bool is_eatsfx_playing = false;
 		if (to_start && !is_eatsfx_playing) {
-			eatsfx = Sound::loop_3D(*EatSFX, 0.4f, camera->transform->position, 5.0f);
+			eatsfx = Sound::loop_3D(*eat_sample, 0.4f, camera->transform->position, 5.0f, 0, world_bus);
 			is_eatsfx_playing = true;
 		}
 		else if(!to_start && is_eatsfx_playing){
@@ -95,7 +106,7 @@ void GardenMode::PlayAudio(AudioStatus as, bool to_start) {
 	}
 	else if (as == AudioStatus::Win) {
 		if (!has_win_played && to_start) {
-			winsfx = Sound::play_3D(*WinSFX, 1.0f, camera->transform->position, 5.0f);
+			winsfx = Sound::play_3D(*win_sample, 1.0f, camera->transform->position, 5.0f, 1, stinger_bus);
 			has_win_played = true;
 		}
 		else if (!to_start) {
@@ -104,7 +115,7 @@ void GardenMode::PlayAudio(AudioStatus as, bool to_start) {
 	}
 	else if (as == AudioStatus::Fail) {
 		if (!has_lose_played && to_start) {
-			failsfx = Sound::play_3D(*FailSFX, 1.0f, camera->transform->position, 5.0f);
+			failsfx = Sound::play_3D(*fail_sample, 1.0f, camera->transform->position, 5.0f, 1, stinger_bus);
 			has_lose_played = true;
 		} else if (!to_start) {
 			failsfx->stop();
@@ -113,30 +124,38 @@ void GardenMode::PlayAudio(AudioStatus as, bool to_start) {
 }
 
 void GardenMode::LoadGameObjects() {
-	for (auto& transform : scene.transforms) {
-		if (transform.name == "opossum") {
-			player = Player(&transform);
-			default_rot = player.transform->rotation;
-		}
-		else if (transform.name == "dirt") {
-			glm::vec3 pos = transform.position;
-			walls[0] = pos.x - 150.f;
-			walls[1] = pos.x + 150.f;
-			walls[2] = pos.y - 100.f;
-			walls[3] = pos.y + 100.f;
-		}
-		else if (transform.name.substr(0, 7) == "cabbage") {
-			foods.push_back(Food(&transform, CABBAGE_SIZE, CABBAGE_EATTIME));
-		}
-		else if (transform.name.substr(0, 6) == "carrot") {
-			foods.push_back(Food(&transform, CARROT_SIZE, CARROT_EATTIME));
-		}
+	if (Scene::Transform *opossum = scene.find("opossum")) {
+		player = Player(opossum);
+		default_rot = player.transform->rotation;
+	}
+	if (Scene::Transform *dirt = scene.find("dirt")) {
+		glm::vec3 pos = dirt->position;
+		walls[0] = pos.x - 150.f;
+		walls[1] = pos.x + 150.f;
+		walls[2] = pos.y - 100.f;
+		walls[3] = pos.y + 100.f;
+	}
+	for (uint32_t index : scene.find_prefix("cabbage")) {
+		foods.push_back(Food(&scene.transforms[index], index, CABBAGE_SIZE, CABBAGE_EATTIME));
+	}
+	for (uint32_t index : scene.find_prefix("carrot")) {
+		foods.push_back(Food(&scene.transforms[index], index, CARROT_SIZE, CARROT_EATTIME));
 	}
 
+	FindFoodDrawables();
+
 	assert(player.transform != nullptr);
 	assert(foods.size() == 20);
 }
 
+void GardenMode::FindFoodDrawables() {
+	for (auto& drawable : scene.drawables) {
+		for (auto& food : foods) {
+			if (drawable.transform == food.transform) food.drawable = &drawable;
+		}
+	}
+}
+
 bool GardenMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size) {
 
 	if (evt.type == SDL_KEYDOWN) {
@@ -244,11 +263,16 @@ void GardenMode::UpdateGameStatus(float elapsed) {
 void GardenMode::UpdateAudio() {
 	if (footsteps)
 		footsteps->set_position(get_foot_position());
+
+	if (world_muffled != is_hidden) {
+		world_muffled = is_hidden;
+		world_muffle->set_cutoff(world_muffled ? 900.0f : 20000.0f, 0.25f);
+	}
 }
 
 void GardenMode::UpdateFootSteps(float elapsed) {
-	static float cool_down = 15.f;
-	static float foot_distance = 0.f;
+	float &cool_down = footsteps_cool_down;
+	float &foot_distance = footsteps_distance;
 	//std::cout << cool_down << std::endl;
 	begin_check = false;
 	if (has_spawned) {
@@ -286,18 +310,13 @@ void GardenMode::UpdateFootSteps(float elapsed) {
 }
 
 void GardenMode::UpdateEating(float elapsed) {
-	static bool has_turned_of_text_eat = false;
 	if(eat.pressed && target >= 0) {
 		has_turned_of_text_eat = false;
 		PlayAudio(AudioStatus::Eat, true);
 		UpdateShowText(elapsed, TextStatus::Eating);
 		foods[target].lifetime -= elapsed;
 		if (foods[target].lifetime <= 0) {
-			for (auto it = scene.drawables.begin(); it != scene.drawables.end(); ++it) {
-				if ((*it).transform->name == foods[target].transform->name) {
-					scene.drawables.erase(it);
-				}
-			}
+			if (foods[target].drawable) foods[target].drawable->enabled = false;
 			std::swap(foods[target], foods[foods.size() - 1]);
 			foods.pop_back();
 			target = -1;
@@ -312,8 +331,7 @@ void GardenMode::UpdateEating(float elapsed) {
 }
 
 void GardenMode::UpdateHiding(float elapsed) {
-	static bool has_turned_of_text_hide = false;
-	static float distance = 0.f;
+	float &distance = hide_distance;
 	is_hiding = distance == 0 ? false : true;
 	is_hidden = false;
 	//std::cout << distance << std::endl;
@@ -349,8 +367,6 @@ void GardenMode::UpdateHiding(float elapsed) {
 
 void GardenMode::UpdateShowText(float elapsed, TextStatus ts) {
 	if (ts == TextStatus::Eating) {
-		static int eat_num_dot = 0;
-		static float eat_cool_down = 0.0f;
 		eat_cool_down += elapsed;
 		if (eat_cool_down >= .4f) {
 			eat_cool_down = 0.0f;
@@ -365,8 +381,6 @@ void GardenMode::UpdateShowText(float elapsed, TextStatus ts) {
 		show_text = "";
 	}
 	else if (ts == TextStatus::Hiding) {
-		static int hide_num_dot = 0;
-		static float hide_cool_down = 0.0f;
 		hide_cool_down += elapsed;
 		if (hide_cool_down >= .4f)
 		{
@@ -460,21 +474,6 @@ void GardenMode::draw(glm::uvec2 const &drawable_size) {
 	//update camera aspect ratio for drawable:
 	camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
-	//set up light type and position for lit_color_texture_program:
-
-	glUseProgram(lit_color_texture_program->program);
-	glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, 1);
-	glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f, -1.0f)));
-	glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
-	glUseProgram(0);
-
-
-	//glUseProgram(lit_color_texture_program->program);
-	//glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, light->type);
-	//glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::eulerAngles(light->transform->rotation) * -1.0f));
-	//glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(light->energy));
-	//glUseProgram(0);
-
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 	glClearDepth(1.0f); //1.0 is actually the default value to clear the depth buffer to, but FYI you can change it.
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -514,3 +513,104 @@ glm::vec3 GardenMode::get_foot_position() {
 
 	return footsteps_pos;
 }
+
+//contents of the "gms0" chunk:
+struct GardenState {
+	glm::vec3 footsteps_pos;
+	float footsteps_cool_down;
+	float footsteps_distance;
+	float hide_distance;
+	int32_t target;
+	uint32_t flags; //bits, in order: is_hiding, is_hidden, has_spawned, begin_check, is_game_over, has_win_played, has_lose_played
+};
+static_assert(sizeof(GardenState) == 4*3 + 4 + 4 + 4 + 4 + 4, "GardenState is packed.");
+
+//contents of the "fds0" chunk (one per uneaten food):
+struct FoodState {
+	uint32_t transform;
+	glm::vec3 size;
+	float lifetime;
+};
+static_assert(sizeof(FoodState) == 4 + 4*3 + 4, "FoodState is packed.");
+
+void GardenMode::save_state(std::vector< char > *blob) const {
+	assert(blob);
+
+	//(the mode's chunks come first, so load_state can check them before the scene's state is touched)
+	GardenState state;
+	state.footsteps_pos = footsteps_pos;
+	state.footsteps_cool_down = footsteps_cool_down;
+	state.footsteps_distance = footsteps_distance;
+	state.hide_distance = hide_distance;
+	state.target = target;
+	bool const bits[7] = {is_hiding, is_hidden, has_spawned, begin_check, is_game_over, has_win_played, has_lose_played};
+	state.flags = 0;
+	for (uint32_t i = 0; i < 7; ++i) {
+		if (bits[i]) state.flags |= (1U << i);
+	}
+	write_chunk("gms0", std::vector< GardenState >(1, state), blob);
+
+	std::vector< FoodState > food_states;
+	food_states.reserve(foods.size());
+	for (auto const &food : foods) {
+		food_states.emplace_back(FoodState{food.transform_index, food.size, food.lifetime});
+	}
+	write_chunk("fds0", food_states, blob);
+
+	scene.save_state(blob);
+}
+
+void GardenMode::load_state(std::vector< char > const &blob) {
+	//read and check everything before changing anything (the blob may be an old or damaged save game):
+	size_t at = 0;
+	std::vector< GardenState > states;
+	read_chunk(blob, &at, "gms0", &states);
+	if (states.size() != 1) throw std::runtime_error("GardenMode state should have exactly one 'gms0' entry.");
+	std::vector< FoodState > food_states;
+	read_chunk(blob, &at, "fds0", &food_states);
+	for (auto const &food : food_states) {
+		if (food.transform >= scene.transforms.size()) throw std::runtime_error("GardenMode state has food with invalid transform index.");
+	}
+	GardenState const &state = states[0];
+	if (state.target < -1 || state.target >= int32_t(food_states.size())) throw std::runtime_error("GardenMode state has invalid target food.");
+
+	//(scene.load_state also checks its chunks before changing anything, so if it throws, nothing has been restored)
+	scene.load_state(blob, &at);
+
+	footsteps_pos = state.footsteps_pos;
+	footsteps_cool_down = state.footsteps_cool_down;
+	footsteps_distance = state.footsteps_distance;
+	hide_distance = state.hide_distance;
+	target = state.target;
+	bool *bits[7] = {&is_hiding, &is_hidden, &has_spawned, &begin_check, &is_game_over, &has_win_played, &has_lose_played};
+	for (uint32_t i = 0; i < 7; ++i) {
+		*bits[i] = (state.flags & (1U << i)) != 0;
+	}
+
+	foods.clear();
+	for (auto const &food : food_states) {
+		foods.emplace_back(&scene.transforms[food.transform], food.transform, food.size, food.lifetime);
+	}
+	FindFoodDrawables();
+
+	//sounds aren't part of the state, so stop whatever is playing and restart the footsteps if a pass was under way:
+	PlayAudio(AudioStatus::Eat, false);
+	if (footsteps) footsteps->stop();
+	if (has_spawned && !is_game_over) PlayAudio(AudioStatus::Footsteps, true);
+
+	//neither is the on-screen text, which the next update will set again:
+	show_text = "";
+	has_turned_of_text_eat = false;
+	has_turned_of_text_hide = false;
+	eat_num_dot = 0;
+	eat_cool_down = 0.0f;
+	hide_num_dot = 0;
+	hide_cool_down = 0.0f;
+}
+
+void GardenMode::restart() {
+	load_state(initial_state);
+
+	//the mode isn't re-created, so also forget any input from the finished game:
+	left = right = down = up = eat = hide = Button();
+}
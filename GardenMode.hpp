@@ -2,6 +2,7 @@
 
 #include "Scene.hpp"
 #include "Sound.hpp"
+#include "SoundEffects.hpp"
 
 #include <glm/glm.hpp>
 
@@ -32,10 +33,12 @@ struct GardenMode : Mode {
 
 	struct Food {
 		Scene::Transform* transform = nullptr;
+		uint32_t transform_index = -1U; //position of transform in scene.transforms (for save_state)
+		Scene::Drawable* drawable = nullptr; //disabled once the food is eaten
 		glm::vec3 size = glm::vec3(30.f, 31.f, 41.f);
 		float lifetime = 0.f;
 		Food() {}
-		Food(Scene::Transform* trans, glm::vec3 food_size, float t) : transform(trans), size(food_size), lifetime(t) {}
+		Food(Scene::Transform* trans, uint32_t index, glm::vec3 food_size, float t) : transform(trans), transform_index(index), size(food_size), lifetime(t) {}
 	};
 
 	enum class TextStatus {
@@ -89,11 +92,24 @@ struct GardenMode : Mode {
 
 	std::vector<Food> foods;
 	glm::vec3 footsteps_pos = glm::vec3(walls[0] + FOOTSTEP_START, 30.f, 16.5f);
+	float footsteps_cool_down = 15.f; //time until the next footsteps pass
+	float footsteps_distance = 0.f; //how far the current pass has come
+	float hide_distance = 0.f; //how far the player has sunk into hiding
+
+	//text and sound latches (these follow from the state above, so load_state resets them rather than saving them):
+	bool is_eatsfx_playing = false;
+	bool has_turned_of_text_eat = false;
+	bool has_turned_of_text_hide = false;
+	int eat_num_dot = 0;
+	float eat_cool_down = 0.0f;
+	int hide_num_dot = 0;
+	float hide_cool_down = 0.0f;
 
 	//light:
 	Scene::Light* light = nullptr;
 
 	void LoadGameObjects();
+	void FindFoodDrawables();
 	void UpdatePlayerMovement(float elapsed);
 	void UpdateEating(float elapsed);
 	void UpdateHiding(float elapsed);
@@ -106,11 +122,30 @@ struct GardenMode : Mode {
 	void StopAllAudio();
 	glm::vec3 get_foot_position();
 
+	//save or restore everything that changes during play (the scene's transforms and the game state above),
+	// e.g. for checkpoints; load_state throws (having changed nothing) if the blob wasn't saved from this level:
+	void save_state(std::vector< char > *blob) const;
+	void load_state(std::vector< char > const &blob);
+
+	//restart the level by restoring the state saved when the mode was created (and clearing input):
+	void restart();
+	std::vector< char > initial_state;
+
 	//audio
+	std::shared_ptr< Sound::Sample const > footsteps_sample;
+	std::shared_ptr< Sound::Sample const > eat_sample;
+	std::shared_ptr< Sound::Sample const > win_sample;
+	std::shared_ptr< Sound::Sample const > fail_sample;
+
 	std::shared_ptr< Sound::PlayingSample > footsteps;
 	std::shared_ptr< Sound::PlayingSample > eatsfx;
 	std::shared_ptr< Sound::PlayingSample > winsfx;
 	std::shared_ptr< Sound::PlayingSample > failsfx;
+
+	std::shared_ptr< Sound::Bus > world_bus; //footsteps, eating
+	std::shared_ptr< Sound::Bus > stinger_bus; //win, fail
+	std::shared_ptr< Sound::LowPass > world_muffle;
+	bool world_muffled = false;
 	
 	//camera:
 	Scene::Camera *camera = nullptr;
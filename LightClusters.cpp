@@ -0,0 +1,204 @@
+#include "LightClusters.hpp"
+
+#include "gl_errors.hpp"
+
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+//lights whose bounds come closer than this (in clip w) are treated as surrounding the camera:
+static constexpr float NearestW = 1e-3f;
+
+LightClusters &LightClusters::get() {
+	static LightClusters clusters;
+	return clusters;
+}
+
+LightClusters::LightClusters() {
+	auto make = [](GLenum format, GLuint *buffer, GLuint *tex) {
+		glGenBuffers(1, buffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, *buffer);
+		//(texture buffers with empty storage are undefined to sample, so always keep something here)
+		glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		glGenTextures(1, tex);
+		glBindTexture(GL_TEXTURE_BUFFER, *tex);
+		glTexBuffer(GL_TEXTURE_BUFFER, format, *buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	};
+	make(GL_RG32UI, &clusters_buffer, &clusters_tex);
+	make(GL_R32UI, &cluster_lights_buffer, &cluster_lights_tex);
+	make(GL_RGBA32F, &local_lights_buffer, &local_lights_tex);
+
+	clusters.assign(LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z, glm::uvec2(0));
+
+	GL_ERRORS();
+}
+
+//upload 'size' bytes to 'buffer', re-specifying its storage so the driver need not wait on earlier draws:
+static void upload(GLuint buffer, void const *data, size_t size) {
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	if (size == 0) {
+		glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+	} else {
+		glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::update(std::vector< UniformBlocks::Light > const &lights, std::vector< glm::vec4 > const &world_spheres,
+	glm::mat4 const &world_to_clip, UniformBlocks::Frame *frame) {
+	assert(frame);
+	assert(lights.size() == world_spheres.size());
+
+	GLint viewport[4] = {0, 0, 1, 1};
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	frame->CLUSTER_COUNT = glm::ivec4(LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y, LIGHT_CLUSTERS_Z, 0);
+	frame->CLUSTER_VIEWPORT = glm::vec4(viewport[0], viewport[1], std::max(viewport[2], 1), std::max(viewport[3], 1));
+	frame->CLUSTER_DEPTH = glm::vec4(0.0f);
+
+	//--- find each light's screen rectangle and depth range ---
+	//(projects the corners of the bounding sphere's box, which is conservative and works for any world_to_clip)
+
+	extents.resize(lights.size());
+	visible.clear();
+
+	float near_w = std::numeric_limits< float >::infinity();
+	float far_w = 0.0f;
+
+	for (uint32_t l = 0; l < lights.size(); ++l) {
+		glm::vec3 center = glm::vec3(world_spheres[l]);
+		float radius = world_spheres[l].w;
+
+		Extent &e = extents[l];
+		e.ndc_min = glm::vec2( std::numeric_limits< float >::infinity());
+		e.ndc_max = glm::vec2(-std::numeric_limits< float >::infinity());
+		e.w_min = std::numeric_limits< float >::infinity();
+		e.w_max = -std::numeric_limits< float >::infinity();
+		bool surrounds = false;
+		for (uint32_t c = 0; c < 8; ++c) {
+			glm::vec3 corner = center + radius * glm::vec3(
+				(c & 1 ? 1.0f : -1.0f),
+				(c & 2 ? 1.0f : -1.0f),
+				(c & 4 ? 1.0f : -1.0f)
+			);
+			glm::vec4 clip = world_to_clip * glm::vec4(corner, 1.0f);
+			e.w_min = std::min(e.w_min, clip.w);
+			e.w_max = std::max(e.w_max, clip.w);
+			if (clip.w <= NearestW) {
+				surrounds = true;
+			} else {
+				glm::vec2 ndc = glm::vec2(clip) / clip.w;
+				e.ndc_min = glm::min(e.ndc_min, ndc);
+				e.ndc_max = glm::max(e.ndc_max, ndc);
+			}
+		}
+
+		//entirely behind the camera:
+		if (e.w_max <= NearestW) continue;
+
+		//part of the box is behind the camera, so projected bounds are meaningless; cover the whole screen:
+		if (surrounds) {
+			e.ndc_min = glm::vec2(-1.0f);
+			e.ndc_max = glm::vec2( 1.0f);
+		}
+
+		//entirely off-screen:
+		if (e.ndc_max.x < -1.0f || e.ndc_min.x > 1.0f || e.ndc_max.y < -1.0f || e.ndc_min.y > 1.0f) continue;
+
+		near_w = std::min(near_w, std::max(e.w_min, NearestW));
+		far_w = std::max(far_w, e.w_max);
+		visible.emplace_back(l);
+	}
+
+	//--- bin visible lights into clusters (counting sort: count, prefix sum, fill) ---
+
+	std::fill(clusters.begin(), clusters.end(), glm::uvec2(0));
+	cluster_lights.clear();
+	bounds.resize(visible.size());
+
+	if (!visible.empty()) {
+		//depth slices are spaced exponentially over just the depth range the lights occupy:
+		far_w = std::max(far_w, near_w * 1.01f);
+		float depth_scale = float(LIGHT_CLUSTERS_Z) / std::log(far_w / near_w);
+
+		auto slice = [&](float w) {
+			float s = std::floor(std::log(std::max(w, near_w) / near_w) * depth_scale);
+			return std::max(0, std::min(LIGHT_CLUSTERS_Z - 1, int32_t(s)));
+		};
+		auto tile = [](float ndc, int32_t count) {
+			float t = std::floor((ndc * 0.5f + 0.5f) * float(count));
+			t = std::max(0.0f, std::min(float(count - 1), t));
+			return int32_t(t);
+		};
+
+		for (uint32_t v = 0; v < visible.size(); ++v) {
+			Extent const &e = extents[visible[v]];
+			Bounds &b = bounds[v];
+			b.min = glm::ivec3(tile(e.ndc_min.x, LIGHT_CLUSTERS_X), tile(e.ndc_min.y, LIGHT_CLUSTERS_Y), slice(e.w_min));
+			b.max = glm::ivec3(tile(e.ndc_max.x, LIGHT_CLUSTERS_X), tile(e.ndc_max.y, LIGHT_CLUSTERS_Y), slice(e.w_max));
+			for (int32_t z = b.min.z; z <= b.max.z; ++z) {
+				for (int32_t y = b.min.y; y <= b.max.y; ++y) {
+					for (int32_t x = b.min.x; x <= b.max.x; ++x) {
+						clusters[(z * LIGHT_CLUSTERS_Y + y) * LIGHT_CLUSTERS_X + x].y += 1;
+					}
+				}
+			}
+		}
+
+		uint32_t total = 0;
+		for (auto &c : clusters) {
+			c.x = total;
+			total += c.y;
+			c.y = 0; //re-counted while filling
+		}
+		cluster_lights.resize(total);
+
+		for (uint32_t v = 0; v < visible.size(); ++v) {
+			Bounds const &b = bounds[v];
+			for (int32_t z = b.min.z; z <= b.max.z; ++z) {
+				for (int32_t y = b.min.y; y <= b.max.y; ++y) {
+					for (int32_t x = b.min.x; x <= b.max.x; ++x) {
+						glm::uvec2 &c = clusters[(z * LIGHT_CLUSTERS_Y + y) * LIGHT_CLUSTERS_X + x];
+						cluster_lights[c.x + c.y] = visible[v];
+						c.y += 1;
+					}
+				}
+			}
+		}
+
+		frame->CLUSTER_COUNT.w = int32_t(visible.size());
+		frame->CLUSTER_DEPTH = glm::vec4(near_w, depth_scale, far_w, 0.0f);
+	}
+
+	//--- upload ---
+	//(lights keep their original indices, so all of them are uploaded even if some were culled)
+
+	upload(clusters_buffer, clusters.data(), clusters.size() * sizeof(glm::uvec2));
+	upload(cluster_lights_buffer, cluster_lights.data(), cluster_lights.size() * sizeof(uint32_t));
+	upload(local_lights_buffer, lights.data(), lights.size() * sizeof(UniformBlocks::Light));
+
+	GL_ERRORS();
+}
+
+void LightClusters::bind() const {
+	glActiveTexture(GL_TEXTURE0 + ClustersUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, clusters_tex);
+	glActiveTexture(GL_TEXTURE0 + ClusterLightsUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, cluster_lights_tex);
+	glActiveTexture(GL_TEXTURE0 + LocalLightsUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, local_lights_tex);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void bind_light_cluster_samplers(GLuint program) {
+	GLint clusters = glGetUniformLocation(program, "CLUSTERS");
+	if (clusters != -1) glUniform1i(clusters, LightClusters::ClustersUnit);
+	GLint cluster_lights = glGetUniformLocation(program, "CLUSTER_LIGHTS");
+	if (cluster_lights != -1) glUniform1i(cluster_lights, LightClusters::ClusterLightsUnit);
+	GLint local_lights = glGetUniformLocation(program, "LOCAL_LIGHTS");
+	if (local_lights != -1) glUniform1i(local_lights, LightClusters::LocalLightsUnit);
+}
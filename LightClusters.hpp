@@ -0,0 +1,134 @@
+#pragma once
+
+/*
+ * Clustered forward lighting for local (point and spot) lights.
+ *
+ * Each frame, the view volume is divided into screen tiles x exponential depth slices ("clusters")
+ *  and every local light's bounding sphere is binned into the clusters it overlaps.
+ * The fragment shader (LIGHTING_GLSL) looks up its own cluster and loops only over the lights in it,
+ *  so scenes can have hundreds of point lights without per-light passes.
+ *
+ * Data lives in three texture buffers bound at fixed texture units (above Scene::Drawable::Pipeline's TextureCount):
+ *  CLUSTERS - per cluster (offset, count) into CLUSTER_LIGHTS
+ *  CLUSTER_LIGHTS - light indices
+ *  LOCAL_LIGHTS - lights, three texels each, in the same layout as UniformBlocks::Light
+ *
+ * Hemisphere and directional lights affect everything, so they stay in the "Frame" block's LIGHTS array.
+ *
+ */
+
+#include "GL.hpp"
+#include "UniformBlocks.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+//cluster grid size (tiles across, tiles down, depth slices):
+#define LIGHT_CLUSTERS_X 16
+#define LIGHT_CLUSTERS_Y 9
+#define LIGHT_CLUSTERS_Z 24
+
+//local lights are culled where their contribution drops below this (about one 8-bit step):
+#define LIGHT_INFLUENCE_THRESHOLD (1.0f / 256.0f)
+
+//GLSL lighting functions; include after FRAME_BLOCK_GLSL.
+// 'vec3 lighting(vec3 position, vec3 n)' returns the energy reaching a (light-space) point with normal n.
+// (uses gl_FragCoord, so is only usable in fragment shaders)
+#define LIGHTING_GLSL \
+	"uniform usamplerBuffer CLUSTERS;\n" \
+	"uniform usamplerBuffer CLUSTER_LIGHTS;\n" \
+	"uniform samplerBuffer LOCAL_LIGHTS;\n" \
+	"vec3 light_energy(Light light, vec3 position, vec3 n) {\n" \
+	"	int type = int(light.POSITION_TYPE.w);\n" \
+	"	vec3 LIGHT_LOCATION = light.POSITION_TYPE.xyz;\n" \
+	"	vec3 LIGHT_DIRECTION = light.DIRECTION_CUTOFF.xyz;\n" \
+	"	float LIGHT_CUTOFF = light.DIRECTION_CUTOFF.w;\n" \
+	"	vec3 LIGHT_ENERGY = light.ENERGY.rgb;\n" \
+	"	if (type == " UNIFORM_BLOCKS_STR(LIGHT_TYPE_POINT) ") { //point light \n" \
+	"		vec3 l = (LIGHT_LOCATION - position);\n" \
+	"		float dis2 = dot(l,l);\n" \
+	"		l = normalize(l);\n" \
+	"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n" \
+	"		return nl * LIGHT_ENERGY;\n" \
+	"	} else if (type == " UNIFORM_BLOCKS_STR(LIGHT_TYPE_HEMISPHERE) ") { //hemi light \n" \
+	"		return (dot(n,-LIGHT_DIRECTION) * 0.5 + 0.5) * LIGHT_ENERGY;\n" \
+	"	} else if (type == " UNIFORM_BLOCKS_STR(LIGHT_TYPE_SPOT) ") { //spot light \n" \
+	"		vec3 l = (LIGHT_LOCATION - position);\n" \
+	"		float dis2 = dot(l,l);\n" \
+	"		l = normalize(l);\n" \
+	"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n" \
+	"		float c = dot(l,-LIGHT_DIRECTION);\n" \
+	"		nl *= smoothstep(LIGHT_CUTOFF,mix(LIGHT_CUTOFF,1.0,0.1), c);\n" \
+	"		return nl * LIGHT_ENERGY;\n" \
+	"	} else { //(type == LIGHT_TYPE_DIRECTIONAL) //directional light \n" \
+	"		return max(0.0, dot(n,-LIGHT_DIRECTION)) * LIGHT_ENERGY;\n" \
+	"	}\n" \
+	"}\n" \
+	"vec3 lighting(vec3 position, vec3 n) {\n" \
+	"	vec3 e = vec3(0.0);\n" \
+	"	for (int i = 0; i < LIGHT_COUNT; ++i) {\n" \
+	"		e += light_energy(LIGHTS[i], position, n);\n" \
+	"	}\n" \
+	"	if (CLUSTER_COUNT.w == 0) return e;\n" \
+	"	float depth = 1.0 / gl_FragCoord.w; //== clip-space w == view depth\n" \
+	"	if (depth < CLUSTER_DEPTH.x || depth > CLUSTER_DEPTH.z) return e; //no local lights this near/far\n" \
+	"	vec2 t = (gl_FragCoord.xy - CLUSTER_VIEWPORT.xy) / CLUSTER_VIEWPORT.zw;\n" \
+	"	ivec2 xy = clamp(ivec2(t * vec2(CLUSTER_COUNT.xy)), ivec2(0), CLUSTER_COUNT.xy - 1);\n" \
+	"	int z = clamp(int(log(depth / CLUSTER_DEPTH.x) * CLUSTER_DEPTH.y), 0, CLUSTER_COUNT.z - 1);\n" \
+	"	uvec2 range = texelFetch(CLUSTERS, (z * CLUSTER_COUNT.y + xy.y) * CLUSTER_COUNT.x + xy.x).xy;\n" \
+	"	for (uint i = 0u; i < range.y; ++i) {\n" \
+	"		int index = int(texelFetch(CLUSTER_LIGHTS, int(range.x + i)).x);\n" \
+	"		Light light;\n" \
+	"		light.POSITION_TYPE = texelFetch(LOCAL_LIGHTS, 3 * index + 0);\n" \
+	"		light.DIRECTION_CUTOFF = texelFetch(LOCAL_LIGHTS, 3 * index + 1);\n" \
+	"		light.ENERGY = texelFetch(LOCAL_LIGHTS, 3 * index + 2);\n" \
+	"		e += light_energy(light, position, n);\n" \
+	"	}\n" \
+	"	return e;\n" \
+	"}\n"
+
+struct LightClusters {
+	enum : GLuint {
+		ClustersUnit = 4,
+		ClusterLightsUnit = 5,
+		LocalLightsUnit = 6,
+	};
+
+	//the shared instance (created on first use; needs a GL context):
+	static LightClusters &get();
+
+	//bin 'lights' (in light space, for shading) using their world-space bounding spheres (xyz: center, w: radius),
+	// upload the result, and fill in the CLUSTER_* fields of 'frame':
+	// (uses the current GL_VIEWPORT to map tiles to pixels)
+	void update(std::vector< UniformBlocks::Light > const &lights, std::vector< glm::vec4 > const &world_spheres,
+		glm::mat4 const &world_to_clip, UniformBlocks::Frame *frame);
+
+	//bind the cluster textures to their texture units:
+	void bind() const;
+
+	//-- internals --
+	LightClusters();
+
+	GLuint clusters_buffer = 0, clusters_tex = 0;
+	GLuint cluster_lights_buffer = 0, cluster_lights_tex = 0;
+	GLuint local_lights_buffer = 0, local_lights_tex = 0;
+
+	//scratch space, kept between frames to avoid re-allocating:
+	struct Extent {
+		glm::vec2 ndc_min, ndc_max; //screen rectangle
+		float w_min, w_max; //clip-space w (== view depth) range
+	};
+	std::vector< Extent > extents; //per light
+	std::vector< uint32_t > visible; //indices of lights that touch the view
+	std::vector< glm::uvec2 > clusters; //(offset, count) per cluster
+	std::vector< uint32_t > cluster_lights;
+	struct Bounds {
+		glm::ivec3 min, max; //inclusive cluster range
+	};
+	std::vector< Bounds > bounds; //per visible light
+};
+
+//point a linked program's CLUSTERS, CLUSTER_LIGHTS, and LOCAL_LIGHTS samplers at their texture units:
+// (program must be current -- i.e., call between glUseProgram(program) and glUseProgram(0))
+void bind_light_cluster_samplers(GLuint program);
@@ -1,6 +1,8 @@
 #include "LitColorTextureProgram.hpp"
 
 #include "gl_compile_program.hpp"
+#include "UniformBlocks.hpp"
+#include "LightClusters.hpp"
 #include "gl_errors.hpp"
 
 Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
@@ -11,17 +13,8 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	//----- build the pipeline template -----
 	lit_color_texture_program_pipeline.program = ret->program;
 
-	lit_color_texture_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-	lit_color_texture_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-	lit_color_texture_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
-
-	/* This will be used later if/when we build a light loop into the Scene:
-	lit_color_texture_program_pipeline.LIGHT_TYPE_int = ret->LIGHT_TYPE_int;
-	lit_color_texture_program_pipeline.LIGHT_LOCATION_vec3 = ret->LIGHT_LOCATION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_DIRECTION_vec3 = ret->LIGHT_DIRECTION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_ENERGY_vec3 = ret->LIGHT_ENERGY_vec3;
-	lit_color_texture_program_pipeline.LIGHT_CUTOFF_float = ret->LIGHT_CUTOFF_float;
-	*/
+	//per-object matrices come from the "Object" uniform block, and lights from the "Frame" block and light clusters (all set by Scene::draw):
+	lit_color_texture_program_pipeline.object_block = true;
 
 	//make a 1-pixel white texture to bind by default:
 	GLuint tex;
@@ -44,13 +37,11 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 });
 
 LitColorTextureProgram::LitColorTextureProgram() {
-	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
-	program = gl_compile_program(
+	//Compile vertex and fragment shaders using the convenient 'gl_submit_program' helper function:
+	program = gl_submit_program(
 		//vertex shader:
 		"#version 330\n"
-		"uniform mat4 OBJECT_TO_CLIP;\n"
-		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
-		"uniform mat3 NORMAL_TO_LIGHT;\n"
+		OBJECT_BLOCK_GLSL
 		"in vec4 Position;\n"
 		"in vec3 Normal;\n"
 		"in vec4 Color;\n"
@@ -69,12 +60,9 @@ LitColorTextureProgram::LitColorTextureProgram() {
 	,
 		//fragment shader:
 		"#version 330\n"
+		FRAME_BLOCK_GLSL
+		LIGHTING_GLSL
 		"uniform sampler2D TEX;\n"
-		"uniform int LIGHT_TYPE;\n"
-		"uniform vec3 LIGHT_LOCATION;\n"
-		"uniform vec3 LIGHT_DIRECTION;\n"
-		"uniform vec3 LIGHT_ENERGY;\n"
-		"uniform float LIGHT_CUTOFF;\n"
 		"in vec3 position;\n"
 		"in vec3 normal;\n"
 		"in vec4 color;\n"
@@ -82,59 +70,36 @@ LitColorTextureProgram::LitColorTextureProgram() {
 		"out vec4 fragColor;\n"
 		"void main() {\n"
 		"	vec3 n = normalize(normal);\n"
-		"	vec3 e;\n"
-		"	if (LIGHT_TYPE == 0) { //point light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
-		"		float dis2 = dot(l,l);\n"
-		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 1) { //hemi light \n"
-		"		e = (dot(n,-LIGHT_DIRECTION) * 0.5 + 0.5) * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 2) { //spot light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
-		"		float dis2 = dot(l,l);\n"
-		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		float c = dot(l,-LIGHT_DIRECTION);\n"
-		"		nl *= smoothstep(LIGHT_CUTOFF,mix(LIGHT_CUTOFF,1.0,0.1), c);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else { //(LIGHT_TYPE == 3) //directional light \n"
-		"		e = max(0.0, dot(n,-LIGHT_DIRECTION)) * LIGHT_ENERGY;\n"
-		"	}\n"
+		"	vec3 e = lighting(position, n);\n"
 		"	vec4 albedo = texture(TEX, texCoord) * color;\n"
 		"	fragColor = vec4(e*albedo.rgb, albedo.a);\n"
 		"}\n"
-	);
-	//As you can see above, adjacent strings in C/C++ are concatenated.
-	// this is very useful for writing long shader programs inline.
-
-	//look up the locations of vertex attributes:
-	Position_vec4 = glGetAttribLocation(program, "Position");
-	Normal_vec3 = glGetAttribLocation(program, "Normal");
-	Color_vec4 = glGetAttribLocation(program, "Color");
-	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
-
-	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-	OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
-	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
+	,
+		//As you can see above, adjacent strings in C/C++ are concatenated.
+		// this is very useful for writing long shader programs inline.
 
-	LIGHT_TYPE_int = glGetUniformLocation(program, "LIGHT_TYPE");
-	LIGHT_LOCATION_vec3 = glGetUniformLocation(program, "LIGHT_LOCATION");
-	LIGHT_DIRECTION_vec3 = glGetUniformLocation(program, "LIGHT_DIRECTION");
-	LIGHT_ENERGY_vec3 = glGetUniformLocation(program, "LIGHT_ENERGY");
-	LIGHT_CUTOFF_float = glGetUniformLocation(program, "LIGHT_CUTOFF");
+		//once linked (see gl_finish_programs):
+		[this]() {
+			//look up the locations of vertex attributes:
+			Position_vec4 = glGetAttribLocation(program, "Position");
+			Normal_vec3 = glGetAttribLocation(program, "Normal");
+			Color_vec4 = glGetAttribLocation(program, "Color");
+			TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
 
+			//point the "Frame" and "Object" blocks at their shared binding points:
+			bind_uniform_blocks(program);
 
-	GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
+			GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
 
-	//set TEX to always refer to texture binding zero:
-	glUseProgram(program); //bind program -- glUniform* calls refer to this program now
+			//set TEX to always refer to texture binding zero:
+			glUseProgram(program); //bind program -- glUniform* calls refer to this program now
 
-	glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
+			glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
+			bind_light_cluster_samplers(program); //(and the light cluster buffers from their units)
 
-	glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
+			glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
+		}
+	);
 }
 
 LitColorTextureProgram::~LitColorTextureProgram() {
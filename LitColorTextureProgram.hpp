@@ -17,20 +17,13 @@ struct LitColorTextureProgram {
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
 
-	//Uniform (per-invocation variable) locations:
-	GLuint OBJECT_TO_CLIP_mat4 = -1U;
-	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
-
-	//lighting:
-	GLuint LIGHT_TYPE_int = -1U;
-	GLuint LIGHT_LOCATION_vec3 = -1U;
-	GLuint LIGHT_DIRECTION_vec3 = -1U;
-	GLuint LIGHT_ENERGY_vec3 = -1U;
-	GLuint LIGHT_CUTOFF_float = -1U;
-	
+	//Uniforms:
+	//"Object" block - OBJECT_TO_CLIP, OBJECT_TO_LIGHT, NORMAL_TO_LIGHT
+	//"Frame" block - LIGHT_COUNT, LIGHTS, CLUSTER_* (see UniformBlocks.hpp)
+
 	//Textures:
 	//TEXTURE0 - texture that is accessed by TexCoord
+	//(plus the point/spot light cluster buffers at LightClusters' units; see LightClusters.hpp)
 };
 
 extern Load< LitColorTextureProgram > lit_color_texture_program;
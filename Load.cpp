@@ -9,11 +9,14 @@ namespace {
 		static std::array< std::list< std::function< void() > >, MaxLoadTag > load_lists;
 		return load_lists;
 	}
+	//tag whose functions are being called (MaxLoadTag when not loading):
+	uint32_t current_tag = MaxLoadTag;
 }
 
 void add_load_function(LoadTag tag, std::function< void() > const &fn) {
 	auto &load_lists = get_load_lists();
 	assert(tag < load_lists.size());
+	assert((current_tag == MaxLoadTag || tag >= current_tag) && "loading functions may only add functions to the current or a later tag");
 	load_lists[tag].emplace_back(fn);
 }
 
@@ -23,10 +26,13 @@ void call_load_functions() {
 	has_been_called = true;
 
 	auto &load_lists = get_load_lists();
-	for (auto &fn_list : load_lists) {
+	for (current_tag = 0; current_tag < load_lists.size(); ++current_tag) {
+		auto &fn_list = load_lists[current_tag];
+		//n.b. functions may append to fn_list while it is being processed; those run at the end:
 		while (!fn_list.empty()) {
 			(*fn_list.begin())(); //call first function in the list
 			fn_list.pop_front(); //remove from list
 		}
 	}
+	current_tag = MaxLoadTag;
 }
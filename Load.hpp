@@ -33,7 +33,8 @@ enum LoadTag : uint32_t {
 };
 
 //Add a function to an internal list of loading functions:
-// (only call *before* "call_load_functions()")
+// (only call *before* "call_load_functions()" -- or from inside a loading function, to queue more work
+//  at the end of the current tag's list or in a later tag; e.g., gl_submit_program uses this)
 void add_load_function(LoadTag tag, std::function< void() > const &fn);
 
 //Call all loading functions:
@@ -2,10 +2,14 @@
 
 #include "gl_errors.hpp"
 #include "read_write_chunk.hpp"
+#include "UniformBlocks.hpp"
+#include "LightClusters.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
 #include <fstream>
+#include <cmath>
+#include <algorithm>
 
 //-------------------------
 
@@ -87,20 +91,117 @@ void Scene::draw(Camera const &camera) const {
 	draw(world_to_clip, world_to_light);
 }
 
+//cluster textures live above the per-drawable texture units so drawing doesn't disturb them:
+static_assert(uint32_t(LightClusters::ClustersUnit) >= uint32_t(Scene::Drawable::Pipeline::TextureCount), "light cluster textures don't overlap drawable textures");
+
 void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+	UniformBlocks &blocks = UniformBlocks::get();
+
+	{ //per-frame data (camera + lights) goes in the "Frame" block shared by all programs:
+		UniformBlocks::Frame frame;
+		frame.WORLD_TO_CLIP = world_to_clip;
+
+		//hemisphere and directional lights go in the block itself; point and spot lights are binned by LightClusters:
+		static std::vector< UniformBlocks::Light > local_lights;
+		static std::vector< glm::vec4 > local_spheres;
+		local_lights.clear();
+		local_spheres.clear();
+
+		int32_t count = 0;
+		for (auto const &light : lights) {
+			assert(light.transform);
+			glm::mat4x3 light_to_world = light.transform->make_local_to_world();
+			//lights are directed along their -z axis:
+			glm::vec3 position = world_to_light * glm::vec4(light_to_world[3], 1.0f);
+			glm::vec3 direction = glm::normalize(world_to_light * glm::vec4(-light_to_world[2], 0.0f));
+
+			int32_t type = LIGHT_TYPE_POINT;
+			if (light.type == Light::Hemisphere) type = LIGHT_TYPE_HEMISPHERE;
+			else if (light.type == Light::Spot) type = LIGHT_TYPE_SPOT;
+			else if (light.type == Light::Directional) type = LIGHT_TYPE_DIRECTIONAL;
+
+			UniformBlocks::Light l;
+			l.POSITION_TYPE = glm::vec4(position, float(type));
+			l.DIRECTION_CUTOFF = glm::vec4(direction, std::cos(0.5f * light.spot_fov));
+			l.ENERGY = glm::vec4(light.energy, 0.0f);
+
+			if (type == LIGHT_TYPE_POINT || type == LIGHT_TYPE_SPOT) {
+				//falloff is energy / distance^2, so the light stops mattering at:
+				float max_energy = std::max(light.energy.r, std::max(light.energy.g, light.energy.b));
+				if (!(max_energy > 0.0f)) continue;
+				float radius = std::sqrt(max_energy / LIGHT_INFLUENCE_THRESHOLD);
+				local_lights.emplace_back(l);
+				local_spheres.emplace_back(light_to_world[3], radius);
+				continue;
+			}
 
-	//Iterate through all drawables, sending each one to OpenGL:
-	for (auto const &drawable : drawables) {
-		//Reference to drawable's pipeline for convenience:
-		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+			if (count == FRAME_MAX_LIGHTS) {
+				static bool warned = false;
+				if (!warned) {
+					std::cerr << "WARNING: scene has more than " << FRAME_MAX_LIGHTS << " hemisphere/directional lights; extra lights will be ignored." << std::endl;
+					warned = true;
+				}
+				continue;
+			}
+			frame.LIGHTS[count] = l;
+			++count;
+		}
+		frame.LIGHT_COUNT.x = count;
+
+		LightClusters &clusters = LightClusters::get();
+		clusters.update(local_lights, local_spheres, world_to_clip, &frame);
+		clusters.bind();
+
+		blocks.set_frame(frame);
+	}
 
+	//skip any drawables that wouldn't draw anything:
+	auto should_draw = [](Drawable const &drawable) {
+		//skip any drawables that have been hidden:
+		if (!drawable.enabled) return false;
 		//skip any drawables without a shader program set:
-		if (pipeline.program == 0) continue;
+		if (drawable.pipeline.program == 0) return false;
 		//skip any drawables that don't reference any vertex array:
-		if (pipeline.vao == 0) continue;
+		if (drawable.pipeline.vao == 0) return false;
 		//skip any drawables that don't contain any vertices:
-		if (pipeline.count == 0) continue;
+		if (drawable.pipeline.count == 0) return false;
+		return true;
+	};
+
+	//compute matrices for a drawable:
+	auto object_to_world = [](Drawable const &drawable) {
+		assert(drawable.transform); //drawables *must* have a transform
+		return drawable.transform->make_local_to_world();
+	};
+
+	{ //per-object data for drawables using the "Object" block is written to the uniform ring all at once:
+		uint32_t count = 0;
+		for (auto const &drawable : drawables) {
+			if (should_draw(drawable) && drawable.pipeline.object_block) ++count;
+		}
+		blocks.map_objects(count);
+		uint32_t index = 0;
+		for (auto const &drawable : drawables) {
+			if (!(should_draw(drawable) && drawable.pipeline.object_block)) continue;
+			glm::mat4x3 o2w = object_to_world(drawable);
+			glm::mat4x3 object_to_light = world_to_light * glm::mat4(o2w);
+
+			UniformBlocks::Object &object = blocks.object(index);
+			object.OBJECT_TO_CLIP = world_to_clip * glm::mat4(o2w);
+			object.OBJECT_TO_LIGHT = glm::mat4(object_to_light);
+			object.NORMAL_TO_LIGHT = glm::mat3x4(glm::inverse(glm::transpose(glm::mat3(object_to_light))));
+			++index;
+		}
+		blocks.unmap_objects();
+	}
+
+	//Iterate through all drawables, sending each one to OpenGL:
+	uint32_t object_index = 0;
+	for (auto const &drawable : drawables) {
+		//Reference to drawable's pipeline for convenience:
+		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
 
+		if (!should_draw(drawable)) continue;
 
 		//Set shader program:
 		glUseProgram(pipeline.program);
@@ -109,29 +210,33 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 		glBindVertexArray(pipeline.vao);
 
 		//Configure program uniforms:
+		if (pipeline.object_block) {
+			//matrices were computed above; just point the "Object" block at them:
+			blocks.bind_object(object_index);
+			++object_index;
+		} else {
+			//the object-to-world matrix is used in all three of these uniforms:
+			glm::mat4x3 o2w = object_to_world(drawable);
 
-		//the object-to-world matrix is used in all three of these uniforms:
-		assert(drawable.transform); //drawables *must* have a transform
-		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
-
-		//OBJECT_TO_CLIP takes vertices from object space to clip space:
-		if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
-			glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
-			glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
-		}
+			//OBJECT_TO_CLIP takes vertices from object space to clip space:
+			if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
+				glm::mat4 object_to_clip = world_to_clip * glm::mat4(o2w);
+				glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+			}
 
-		//the object-to-light matrix is used in the next two uniforms:
-		glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+			//the object-to-light matrix is used in the next two uniforms:
+			glm::mat4x3 object_to_light = world_to_light * glm::mat4(o2w);
 
-		//OBJECT_TO_CLIP takes vertices from object space to light space:
-		if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
-			glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
-		}
+			//OBJECT_TO_CLIP takes vertices from object space to light space:
+			if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+			}
 
-		//NORMAL_TO_CLIP takes normals from object space to light space:
-		if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
-			glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
-			glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+			//NORMAL_TO_CLIP takes normals from object space to light space:
+			if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
+				glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
+				glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+			}
 		}
 
 		//set any requested custom uniforms:
@@ -169,6 +274,15 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 void Scene::load(std::string const &filename,
 	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
 
+	load_file(filename, [this, &on_drawable](Transform *transform, std::string const &mesh_name) {
+		if (on_drawable) {
+			on_drawable(*this, transform, mesh_name);
+		}
+	});
+}
+
+void Scene::load_file(std::string const &filename, std::function< void(Transform *, std::string const &) > const &on_mesh) {
+
 	std::ifstream file(filename, std::ios::binary);
 
 	std::vector< char > names;
@@ -257,9 +371,7 @@ void Scene::load(std::string const &filename,
 		}
 		std::string name = std::string(names.begin() + m.name_begin, names.begin() + m.name_end);
 
-		if (on_drawable) {
-			on_drawable(*this, hierarchy_transforms[m.transform], name);
-		}
+		on_mesh(hierarchy_transforms[m.transform], name);
 
 	}
 
@@ -308,6 +420,8 @@ void Scene::load(std::string const &filename,
 		std::cerr << "WARNING: trailing data in scene file '" << filename << "'" << std::endl;
 	}
 
+	index_names();
+
 
 
 }
@@ -318,6 +432,52 @@ Scene::Scene(std::string const &filename, std::function< void(Scene &, Transform
 	load(filename, on_drawable);
 }
 
+std::unique_ptr< Scene::AsyncLoad > Scene::load_async(std::string const &filename,
+	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable,
+	std::unique_ptr< Scene > &&into) {
+
+	assert(into);
+	std::unique_ptr< AsyncLoad > loading(new AsyncLoad);
+	loading->on_drawable = on_drawable;
+	loading->scene = std::move(into);
+
+	//the worker only touches the scene and the mesh list, which the main thread leaves alone until it is done:
+	Scene *scene = loading->scene.get();
+	auto *meshes = &loading->meshes;
+	loading->parsing = std::async(std::launch::async, [filename, scene, meshes]() {
+		scene->load_file(filename, [meshes](Transform *transform, std::string const &mesh_name) {
+			meshes->emplace_back(transform, mesh_name);
+		});
+	});
+
+	return loading;
+}
+
+std::unique_ptr< Scene > Scene::AsyncLoad::poll(uint32_t batch) {
+	if (!scene) return nullptr; //(already handed over, or failed)
+
+	if (!parsed) {
+		if (parsing.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return nullptr;
+		try {
+			parsing.get();
+		} catch (...) {
+			scene.reset();
+			throw;
+		}
+		parsed = true;
+	}
+
+	//make drawables, a batch per call:
+	for (uint32_t i = 0; i < batch && next_mesh < meshes.size(); ++i, ++next_mesh) {
+		if (on_drawable) {
+			on_drawable(*scene, meshes[next_mesh].first, meshes[next_mesh].second);
+		}
+	}
+	if (next_mesh < meshes.size()) return nullptr;
+
+	return std::move(scene);
+}
+
 Scene::Scene(Scene const &other) {
 	set(other);
 }
@@ -333,6 +493,7 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 	std::unordered_map< Transform const *, Transform * > &transform_to_transform = *(transform_map_ ? transform_map_ : &t2t_temp);
 
 	transform_to_transform.clear();
+	transform_to_transform.reserve(other.transforms.size() + 1);
 
 	//null transform maps to itself:
 	transform_to_transform.insert(std::make_pair(nullptr, nullptr));
@@ -342,6 +503,7 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 	for (auto const &t : other.transforms) {
 		transforms.emplace_back();
 		transforms.back().name = t.name;
+		transforms.back().tag = t.tag;
 		transforms.back().position = t.position;
 		transforms.back().rotation = t.rotation;
 		transforms.back().scale = t.scale;
@@ -357,6 +519,10 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 		t.parent = transform_to_transform.at(t.parent);
 	}
 
+	//(transforms are in the same order, so the name index still applies)
+	name_index = other.name_index;
+	tags = other.tags;
+
 	//copy other's drawables, updating transform pointers:
 	drawables = other.drawables;
 	for (auto &d : drawables) {
@@ -375,3 +541,124 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 		l.transform = transform_to_transform.at(l.transform);
 	}
 }
+
+//-------------------------
+
+void Scene::index_names() {
+	name_index.resize(transforms.size());
+	for (uint32_t i = 0; i < name_index.size(); ++i) {
+		name_index[i] = i;
+	}
+	//(stable, so transforms with the same name stay in scene order)
+	std::stable_sort(name_index.begin(), name_index.end(), [this](uint32_t a, uint32_t b) {
+		return transforms[a].name < transforms[b].name;
+	});
+
+	//intern tags:
+	tags.clear();
+	tags.reserve(transforms.size());
+	for (auto const &t : transforms) {
+		tags.emplace_back(t.name.substr(0, t.name.find('.')));
+	}
+	std::sort(tags.begin(), tags.end());
+	tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+	for (auto &t : transforms) {
+		t.tag = find_tag(t.name.substr(0, t.name.find('.')));
+	}
+}
+
+Scene::Transform const *Scene::find(std::string const &name) const {
+	auto at = std::lower_bound(name_index.begin(), name_index.end(), name, [this](uint32_t i, std::string const &n) {
+		return transforms[i].name < n;
+	});
+	if (at == name_index.end() || transforms[*at].name != name) return nullptr;
+	return &transforms[*at];
+}
+
+Scene::Transform *Scene::find(std::string const &name) {
+	return const_cast< Transform * >(static_cast< Scene const & >(*this).find(name));
+}
+
+std::vector< uint32_t > Scene::find_prefix(std::string const &prefix) const {
+	std::vector< uint32_t > found;
+	auto at = std::lower_bound(name_index.begin(), name_index.end(), prefix, [this](uint32_t i, std::string const &n) {
+		return transforms[i].name < n;
+	});
+	//(every name starting with 'prefix' sorts at or after it, and they are all together)
+	for (; at != name_index.end(); ++at) {
+		std::string const &name = transforms[*at].name;
+		if (name.compare(0, prefix.size(), prefix) != 0) break;
+		found.emplace_back(*at);
+	}
+	return found;
+}
+
+uint32_t Scene::find_tag(std::string const &tag) const {
+	auto at = std::lower_bound(tags.begin(), tags.end(), tag);
+	if (at == tags.end() || *at != tag) return -1U;
+	return uint32_t(at - tags.begin());
+}
+
+void Scene::compact_drawables() {
+	drawables.remove_if([](Drawable const &drawable) {
+		return !drawable.enabled;
+	});
+}
+
+//-------------------------
+
+//contents of the "xfs0" chunk (one per transform):
+struct TransformState {
+	glm::vec3 position;
+	glm::quat rotation;
+	glm::vec3 scale;
+};
+static_assert(sizeof(TransformState) == 4*3 + 4*4 + 4*3, "TransformState is packed.");
+
+void Scene::save_state(std::vector< char > *blob) const {
+	assert(blob);
+	std::vector< TransformState > states;
+	states.reserve(transforms.size());
+	for (auto const &t : transforms) {
+		states.emplace_back(TransformState{t.position, t.rotation, t.scale});
+	}
+	write_chunk("xfs0", states, blob);
+
+	//drawable count, then drawable enable flags packed 32 to a word:
+	std::vector< uint32_t > enabled(1 + (drawables.size() + 31) / 32, 0);
+	enabled[0] = uint32_t(drawables.size());
+	uint32_t index = 0;
+	for (auto const &d : drawables) {
+		if (d.enabled) enabled[1 + index / 32] |= (1U << (index % 32));
+		++index;
+	}
+	write_chunk("den0", enabled, blob);
+}
+
+void Scene::load_state(std::vector< char > const &blob, size_t *at) {
+	//read and check everything before changing anything:
+	std::vector< TransformState > states;
+	read_chunk(blob, at, "xfs0", &states);
+	if (states.size() != transforms.size()) {
+		throw std::runtime_error("scene snapshot has " + std::to_string(states.size()) + " transforms, but scene has " + std::to_string(transforms.size()) + ".");
+	}
+	std::vector< uint32_t > enabled;
+	read_chunk(blob, at, "den0", &enabled);
+	if (enabled.empty() || enabled[0] != drawables.size() || enabled.size() != 1 + (drawables.size() + 31) / 32) {
+		throw std::runtime_error("scene snapshot has " + (enabled.empty() ? std::string("no") : std::to_string(enabled[0])) + " drawables, but scene has " + std::to_string(drawables.size()) + ".");
+	}
+
+	auto state = states.begin();
+	for (auto &t : transforms) {
+		t.position = state->position;
+		t.rotation = state->rotation;
+		t.scale = state->scale;
+		++state;
+	}
+
+	uint32_t index = 0;
+	for (auto &d : drawables) {
+		d.enabled = (enabled[1 + index / 32] & (1U << (index % 32))) != 0;
+		++index;
+	}
+}
@@ -16,7 +16,9 @@
 #include <glm/gtc/quaternion.hpp>
 
 #include <list>
+#include <deque>
 #include <memory>
+#include <future>
 #include <functional>
 #include <string>
 #include <vector>
@@ -26,6 +28,8 @@ struct Scene {
 	struct Transform {
 		//Transform names are useful for debugging and looking up locations in a loaded scene:
 		std::string name;
+		//..and the part of the name before any '.' (e.g., "cabbage" for "cabbage.001"), interned for cheap comparisons (see Scene::tags):
+		uint32_t tag = -1U;
 
 		//The core function of a transform is to store a transformation in the world:
 		glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
@@ -54,6 +58,10 @@ struct Scene {
 		Drawable(Transform *transform_) : transform(transform_) { assert(transform); }
 		Transform * transform;
 
+		//disabled drawables stay in the scene (so pointers to them remain valid handles) but aren't drawn;
+		// hiding and showing things this way costs nothing, while erasing from 'drawables' frees memory:
+		bool enabled = true;
+
 		//Contains all the data needed to run the OpenGL pipeline:
 		struct Pipeline {
 			GLuint program = 0; //shader program; passed to glUseProgram
@@ -69,6 +77,8 @@ struct Scene {
 			GLuint OBJECT_TO_CLIP_mat4 = -1U; //uniform location for object to clip space matrix
 			GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
 			GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
+			//..or, for programs that declare the "Object" uniform block (see UniformBlocks.hpp), the same matrices come from there:
+			bool object_block = false;
 
 			std::function< void() > set_uniforms; //(optional) function to set any other useful uniforms
 
@@ -117,12 +127,28 @@ struct Scene {
 	};
 
 	//Scenes, of course, may have many of the above objects:
-	std::list< Transform > transforms;
+	// (transforms are kept in a deque -- never moved by emplace_back, like a list, but indexable, which the name index and snapshots use -- so never erase from the middle of it)
+	std::deque< Transform > transforms;
 	std::list< Drawable > drawables;
 	std::list< Camera > cameras;
 	std::list< Light > lights;
 
+	//Name lookups, for setup code that needs particular transforms; these binary-search the name index (built by load()):
+	Transform *find(std::string const &name); //first transform named exactly 'name', or nullptr
+	Transform const *find(std::string const &name) const;
+	std::vector< uint32_t > find_prefix(std::string const &prefix) const; //positions in 'transforms' of all transforms whose names start with 'prefix', in name order
+	uint32_t find_tag(std::string const &tag) const; //the interned form of 'tag' (compare with Transform::tag), or -1U if no transform has it
+
+	void index_names(); //(re)build the name index and tags -- call after adding or renaming transforms, or lookups won't find them
+	std::vector< uint32_t > name_index; //positions in 'transforms', sorted by name
+	std::vector< std::string > tags; //sorted; Transform::tag indexes this
+
+	//erase all disabled drawables (e.g., after a level is finished with a lot of spawned props):
+	// (pointers to the erased drawables become invalid, as do snapshots taken earlier -- see save_state)
+	void compact_drawables();
+
 	//The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
+	// (it also uploads the camera and the scene's lights to the "Frame" uniform block; see UniformBlocks.hpp)
 	void draw(Camera const &camera) const;
 
 	//..sometimes, you want to draw with a custom projection matrix and/or light space:
@@ -135,12 +161,40 @@ struct Scene {
 		std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable = nullptr
 	);
 
+	//the part of load() that reads the file; on_mesh is called for each mesh entry (after its transform exists):
+	void load_file(std::string const &filename, std::function< void(Transform *, std::string const &) > const &on_mesh);
+
+	//Load a scene without stalling the main loop (e.g., for level transitions):
+	// the file is read -- and transforms, cameras, and lights made -- on a worker thread;
+	// the on_drawable calls, which usually need the GL thread, are then made from poll() a batch at a time.
+	// Call poll() from the main thread each frame, and adopt the scene by swapping pointers once it is ready:
+	//   if (std::unique_ptr< Scene > ready = loading->poll()) { scene = std::move(ready); loading.reset(); }
+	struct AsyncLoad {
+		//make up to 'batch' on_drawable calls once the file is read; returns the scene after the last call (and nullptr until then, or once returned):
+		// (rethrows anything thrown while reading the file)
+		std::unique_ptr< Scene > poll(uint32_t batch = 256);
+
+		std::function< void(Scene &, Transform *, std::string const &) > on_drawable;
+		std::unique_ptr< Scene > scene; //being loaded
+		std::vector< std::pair< Transform *, std::string > > meshes; //found by the worker
+		size_t next_mesh = 0; //next on_drawable call to make
+		bool parsed = false; //worker is done
+		//(declared last so it is destroyed first: the destructor of a std::async future waits for the worker)
+		std::future< void > parsing;
+	};
+	//start loading 'filename' into 'into' (which may be a subclass of Scene -- its load_extra runs on the worker, too):
+	static std::unique_ptr< AsyncLoad > load_async(std::string const &filename,
+		std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable = nullptr,
+		std::unique_ptr< Scene > &&into = std::make_unique< Scene >()
+	);
+
 	//this function is called to read extra chunks from the scene file after the main chunks are read:
 	// this is useful if you, e.g., subclassing scene to represent a game level/area
 	virtual void load_extra(std::istream &from, std::vector< char > const &str0, std::vector< Transform * > const &xfh0) { }
 
 	//empty scene:
 	Scene() = default;
+	virtual ~Scene() = default; //(subclasses may be loaded through load_async)
 
 	//load a scene:
 	Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable);
@@ -150,4 +204,12 @@ struct Scene {
 	Scene &operator=(Scene const &); //...as scene = scene
 	//... as a set() function that optionally returns the transform->transform mapping:
 	void set(Scene const &, std::unordered_map< Transform const *, Transform * > *transform_map = nullptr);
+
+	//Snapshots of the parts of a scene that change during play (transform positions, rotations, and scales; drawable enable flags),
+	// for restarting, checkpoints, rollback, or save games. A snapshot only fits the scene it was taken from
+	// (or a copy of that scene) -- i.e., one with the same transforms and drawables in the same order.
+	//append a snapshot to 'blob' (as "xfs0" and "den0" chunks -- the latter is the drawable count, then the packed enable flags; see read_write_chunk.hpp):
+	void save_state(std::vector< char > *blob) const;
+	//restore the snapshot starting at blob[*at], advancing *at past it; throws if it doesn't fit this scene:
+	void load_state(std::vector< char > const &blob, size_t *at);
 };
@@ -1,6 +1,7 @@
 #include "ShowSceneProgram.hpp"
 
 #include "gl_compile_program.hpp"
+#include "UniformBlocks.hpp"
 #include "gl_errors.hpp"
 
 Scene::Drawable::Pipeline show_scene_program_pipeline;
@@ -10,21 +11,18 @@ Load< ShowSceneProgram > show_scene_program(LoadTagEarly, []() -> ShowSceneProgr
 
 	show_scene_program_pipeline.program = ret->program;
 
-	show_scene_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-	show_scene_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-	show_scene_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
+	//per-object matrices come from the "Object" uniform block:
+	show_scene_program_pipeline.object_block = true;
 
 	return ret;
 });
 
 ShowSceneProgram::ShowSceneProgram() {
-	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
-	program = gl_compile_program(
+	//Compile vertex and fragment shaders using the convenient 'gl_submit_program' helper function:
+	program = gl_submit_program(
 		//vertex shader:
 		"#version 330\n"
-		"uniform mat4 OBJECT_TO_CLIP;\n"
-		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
-		"uniform mat3 NORMAL_TO_LIGHT;\n"
+		OBJECT_BLOCK_GLSL
 		"in vec4 Position;\n"
 		"in vec3 Normal;\n"
 		"in vec4 Color;\n"
@@ -71,20 +69,22 @@ ShowSceneProgram::ShowSceneProgram() {
 		"		fragColor = vec4(mix(vec3(0.5), vec3(1.0), 0.5 * dot(n,l) + 0.5) * color.rgb, color.a);\n"
 		"	}\n"
 		"}\n"
-	);
-
-	//look up the locations of vertex attributes:
-	Position_vec4 = glGetAttribLocation(program, "Position");
-	Normal_vec3 = glGetAttribLocation(program, "Normal");
-	Color_vec4 = glGetAttribLocation(program, "Color");
-	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
+	,
+		//once linked (see gl_finish_programs):
+		[this]() {
+			//look up the locations of vertex attributes:
+			Position_vec4 = glGetAttribLocation(program, "Position");
+			Normal_vec3 = glGetAttribLocation(program, "Normal");
+			Color_vec4 = glGetAttribLocation(program, "Color");
+			TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
 
-	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-	OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
-	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
+			//point the "Object" block at its shared binding point:
+			bind_uniform_blocks(program);
 
-	INSPECT_MODE_int = glGetUniformLocation(program, "INSPECT_MODE");
+			//look up the locations of uniforms:
+			INSPECT_MODE_int = glGetUniformLocation(program, "INSPECT_MODE");
+		}
+	);
 }
 
 ShowSceneProgram::~ShowSceneProgram() {
@@ -20,10 +20,7 @@ struct ShowSceneProgram {
 	GLuint TexCoord_vec2 = -1U;
 
 	//Uniform (per-invocation variable) locations:
-	GLuint OBJECT_TO_CLIP_mat4 = -1U;
-	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
-
+	//("Object" block - OBJECT_TO_CLIP, OBJECT_TO_LIGHT, NORMAL_TO_LIGHT; see UniformBlocks.hpp)
 	GLuint INSPECT_MODE_int = -1U; //0: basic lighting; 1: position only; 2: normal only; 3: color only; 4: texcoord only
 
 	//Textures:
@@ -31,4 +28,4 @@ struct ShowSceneProgram {
 };
 
 extern Load< ShowSceneProgram > show_scene_program;
-extern Scene::Drawable::Pipeline show_scene_program_pipeline; //Drawable::Pipeline already initialized with proper uniform locations for this program.
+extern Scene::Drawable::Pipeline show_scene_program_pipeline; //Drawable::Pipeline already initialized for this program.
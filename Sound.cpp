@@ -1,21 +1,37 @@
 #include "Sound.hpp"
 #include "load_wav.hpp"
 #include "load_opus.hpp"
+#include "adpcm.hpp"
+#include "pcm_cache.hpp"
 
 #include <SDL.h>
 
 #include <list>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
 #include <cassert>
 #include <exception>
 #include <iostream>
 #include <algorithm>
+#include <limits>
+
+struct MixWorkers;
 
 //local (to this file) data used by the audio system:
 namespace {
 
 	//handy constants:
-	constexpr uint32_t const AUDIO_RATE = 48000; //sampling rate
-	constexpr uint32_t const MIX_SAMPLES = 1024; //number of samples to mix per call of mix_audio callback; n.b. SDL requires this to be a power of two
+	using Sound::AUDIO_RATE;
+	//number of samples in a mix period -- ramps, panning, and voice selection are updated once per period,
+	// and each mix_audio callback mixes (device block size / MIX_SAMPLES) periods:
+	constexpr uint32_t const MIX_SAMPLES = Sound::MinBlockSize;
+	static_assert((Sound::MinBlockSize & (Sound::MinBlockSize - 1)) == 0, "block sizes are powers of two, so are multiples of the period");
+
+	//samples per mix_audio callback (see Sound::set_block_size); n.b. SDL requires this to be a power of two:
+	uint32_t block_samples = 1024;
 
 	//The audio device:
 	SDL_AudioDeviceID device = 0;
@@ -23,6 +39,77 @@ namespace {
 	//list of all currently playing samples:
 	std::list< std::shared_ptr< Sound::PlayingSample > > playing_samples;
 
+	//sample clock -- time (in samples) of the start of the next period to be mixed (see Sound::get_sample_clock):
+	// (only advanced by the callback, but read from other threads)
+	std::atomic< uint64_t > sample_clock(0);
+
+	//every bus, in creation order (so parents always come before their children):
+	std::vector< std::weak_ptr< Sound::Bus > > buses;
+
+	//optional worker pool for mixing (see Sound::set_mix_threads; defined with the mixer below):
+	MixWorkers *mix_workers = nullptr;
+
+	//voice limiting (see Sound::set_max_voices):
+	uint32_t max_voices = 32;
+	float audibility_threshold = 1.0e-3f; //about -60dB
+
+	//quality of resampling for samples not playing at rate 1 (see Sound::set_resample_quality):
+	Sound::ResampleQuality resample_quality = Sound::ResampleLinear;
+
+	//output limiter settings (see Sound::set_limiter):
+	bool limiter_enabled = true;
+	float limiter_ceiling = 0.98f;
+	float limiter_release = 0.1f;
+
+	//telemetry, written by the callback and read without locking by Sound::get_mixer_stats:
+	std::atomic< float > stat_peak_level(0.0f);
+	std::atomic< float > stat_limiter_gain(1.0f);
+	std::atomic< uint64_t > stat_clipped_samples(0);
+	std::atomic< float > stat_callback_seconds(0.0f);
+	std::atomic< uint32_t > stat_active_voices(0);
+	std::atomic< uint32_t > stat_playing_samples(0);
+
+	//callback timing (see Sound::get_callback_stats), in performance counter ticks:
+	std::atomic< uint64_t > timing_histogram[Sound::CallbackStats::Buckets];
+	std::atomic< uint64_t > timing_callbacks(0);
+	std::atomic< uint64_t > timing_total(0);
+	std::atomic< uint64_t > timing_max(0);
+	std::atomic< uint64_t > timing_over_budget(0);
+	std::atomic< uint64_t > timing_late(0);
+	std::atomic< uint64_t > timing_max_interval(0);
+	Uint64 previous_callback_start = 0; //(only touched by the callback)
+
+	//shared sample cache (guarded by its own mutex, since it is never touched by the audio callback):
+	struct CachedSample {
+		std::shared_ptr< Sound::Sample const > sample;
+		uint64_t last_used = 0;
+	};
+	std::mutex sample_cache_mutex;
+	std::unordered_map< std::string, CachedSample > sample_cache;
+	uint64_t sample_cache_clock = 0; //incremented on every get_sample()
+	size_t sample_cache_budget = size_t(64) << 20;
+
+	//free least-recently-used, unreferenced samples until under budget (call with sample_cache_mutex held):
+	void trim_sample_cache() {
+		size_t total = 0;
+		std::vector< std::unordered_map< std::string, CachedSample >::iterator > evictable;
+		for (auto c = sample_cache.begin(); c != sample_cache.end(); ++c) {
+			total += c->second.sample->resident_bytes();
+			//only the cache holds a reference, so nothing can be playing it:
+			if (c->second.sample.use_count() == 1) evictable.emplace_back(c);
+		}
+		if (total <= sample_cache_budget) return;
+
+		std::sort(evictable.begin(), evictable.end(), [](auto const &a, auto const &b) {
+			return a->second.last_used < b->second.last_used;
+		});
+		for (auto const &c : evictable) {
+			if (total <= sample_cache_budget) break;
+			total -= c->second.sample->resident_bytes();
+			sample_cache.erase(c);
+		}
+	}
+
 }
 
 //public-facing data:
@@ -36,22 +123,186 @@ Sound::Listener Sound::listener;
 //This audio-mixing callback is defined below:
 void mix_audio(void *, Uint8 *buffer_, int len);
 
+//Open the audio device with the current block size (defined below):
+void open_device();
+
+//(Re-)create the mixing worker pool (also defined below):
+void set_mix_workers(uint32_t count);
+
 //------------------------ public-facing --------------------------------
 
-Sound::Sample::Sample(std::string const &filename) {
+Sound::Sample::Sample(std::string const &filename, Format format_) {
+	//data chunk names for cached samples, per format:
+	static char const *CacheMagic[3] = {"f320", "s160", "adp0"};
+	std::string magic = (format_ <= ADPCM ? CacheMagic[format_] : "");
+
+	if (!magic.empty()) {
+		PCMCacheEntry cached;
+		if (load_pcm_cache(filename, magic, &cached) && cached.bytes == stored_bytes(format_, cached.length)) {
+			format = format_;
+			length = cached.length;
+			mapping = cached.mapping;
+			mapped = cached.data;
+			mapped_bytes = cached.bytes;
+			return;
+		}
+	}
+
+	std::vector< float > decoded;
 	if (filename.size() >= 4 && filename.substr(filename.size()-4) == ".wav") {
-		load_wav(filename, &data);
+		load_wav(filename, &decoded);
 	} else if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus") {
-		load_opus(filename, &data);
+		load_opus(filename, &decoded);
 	} else {
 		throw std::runtime_error("Sample '" + filename + "' doesn't end in either \".png\" or \".opus\" -- unsure how to load.");
 	}
+	store(std::move(decoded), format_);
+
+	if (!magic.empty()) {
+		if (format == Float32) save_pcm_cache(filename, magic, length, data.data(), data.size() * sizeof(float));
+		else if (format == Int16) save_pcm_cache(filename, magic, length, data_int16.data(), data_int16.size() * sizeof(int16_t));
+		else if (format == ADPCM) save_pcm_cache(filename, magic, length, data_adpcm.data(), data_adpcm.size());
+	}
+}
+
+size_t Sound::Sample::stored_bytes(Format format, uint32_t length) {
+	if (format == Float32) return size_t(length) * sizeof(float);
+	if (format == Int16) return size_t(length) * sizeof(int16_t);
+	return (size_t(length) + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES * ADPCM_BLOCK_BYTES;
+}
+
+Sound::Sample::Sample(std::vector< float > const &data_, Format format_) {
+	store(std::vector< float >(data_), format_);
+}
+
+void Sound::Sample::store(std::vector< float > &&data_, Format format_) {
+	if (data_.size() > std::numeric_limits< uint32_t >::max()) {
+		throw std::runtime_error("Sample of " + std::to_string(data_.size()) + " samples is too long.");
+	}
+	format = format_;
+	length = uint32_t(data_.size());
+	mapping.reset();
+	mapped = nullptr;
+	mapped_bytes = 0;
+	data.clear();
+	data_int16.clear();
+	data_adpcm.clear();
+	if (format == Float32) {
+		data = std::move(data_);
+	} else if (format == Int16) {
+		data_int16.resize(length);
+		for (uint32_t i = 0; i < length; ++i) {
+			float f = std::max(-1.0f, std::min(1.0f, data_[i]));
+			data_int16[i] = int16_t(std::round(f * 32767.0f));
+		}
+	} else if (format == ADPCM) {
+		encode_adpcm(data_.data(), data_.size(), &data_adpcm);
+	} else {
+		throw std::runtime_error("Unknown sample format " + std::to_string(int(format)) + ".");
+	}
+}
+
+void Sound::Sample::read(uint32_t begin, uint32_t count, float *out) const {
+	assert(begin + count <= length);
+	if (format == Float32) {
+		float const *in = (mapped ? static_cast< float const * >(mapped) : data.data()) + begin;
+		std::copy(in, in + count, out);
+	} else if (format == Int16) {
+		constexpr float const Scale = 1.0f / 32767.0f;
+		int16_t const *in = (mapped ? static_cast< int16_t const * >(mapped) : data_int16.data()) + begin;
+		for (uint32_t i = 0; i < count; ++i) {
+			out[i] = in[i] * Scale;
+		}
+	} else {
+		assert(format == ADPCM);
+		while (count > 0) {
+			uint32_t block = begin / ADPCM_BLOCK_SAMPLES;
+			uint32_t offset = begin % ADPCM_BLOCK_SAMPLES;
+			uint32_t n = std::min(count, ADPCM_BLOCK_SAMPLES - offset);
+			uint8_t const *blocks = (mapped ? static_cast< uint8_t const * >(mapped) : data_adpcm.data());
+			decode_adpcm(blocks + size_t(block) * ADPCM_BLOCK_BYTES, offset, n, out);
+			begin += n;
+			count -= n;
+			out += n;
+		}
+	}
 }
 
-Sound::Sample::Sample(std::vector< float > const &data_) : data(data_) {
+size_t Sound::Sample::resident_bytes() const {
+	//(mapped data counts too, even though the OS can drop its pages when memory is short)
+	return data.capacity() * sizeof(float)
+	     + data_int16.capacity() * sizeof(int16_t)
+	     + data_adpcm.capacity() * sizeof(uint8_t)
+	     + mapped_bytes;
 }
 
+//------------------
 
+std::shared_ptr< Sound::Sample const > Sound::get_sample(std::string const &filename, Sample::Format format) {
+	{ //already loaded?
+		std::lock_guard< std::mutex > guard(sample_cache_mutex);
+		auto f = sample_cache.find(filename);
+		if (f != sample_cache.end()) {
+			f->second.last_used = ++sample_cache_clock;
+			return f->second.sample;
+		}
+	}
+
+	//decode without holding the lock, so other threads can keep using the cache:
+	std::shared_ptr< Sample const > sample = std::make_shared< Sample >(filename, format);
+
+	std::lock_guard< std::mutex > guard(sample_cache_mutex);
+	//(if another thread loaded the same file meanwhile, this emplace keeps its copy)
+	auto ret = sample_cache.emplace(filename, CachedSample{sample, 0});
+	ret.first->second.last_used = ++sample_cache_clock;
+	sample = ret.first->second.sample;
+	trim_sample_cache();
+	return sample;
+}
+
+void Sound::set_sample_cache_budget(size_t bytes) {
+	std::lock_guard< std::mutex > guard(sample_cache_mutex);
+	sample_cache_budget = bytes;
+	trim_sample_cache();
+}
+
+size_t Sound::get_sample_cache_budget() {
+	std::lock_guard< std::mutex > guard(sample_cache_mutex);
+	return sample_cache_budget;
+}
+
+std::vector< Sound::SampleCacheInfo > Sound::get_sample_cache_info() {
+	std::lock_guard< std::mutex > guard(sample_cache_mutex);
+	std::vector< std::pair< uint64_t, SampleCacheInfo > > entries;
+	entries.reserve(sample_cache.size());
+	for (auto const &[filename, cached] : sample_cache) {
+		SampleCacheInfo info;
+		info.filename = filename;
+		info.resident_bytes = cached.sample->resident_bytes();
+		info.references = cached.sample.use_count() - 1;
+		entries.emplace_back(cached.last_used, info);
+	}
+	std::sort(entries.begin(), entries.end(), [](auto const &a, auto const &b) {
+		return a.first > b.first;
+	});
+	std::vector< SampleCacheInfo > ret;
+	ret.reserve(entries.size());
+	for (auto &e : entries) {
+		ret.emplace_back(std::move(e.second));
+	}
+	return ret;
+}
+
+size_t Sound::get_sample_cache_resident_bytes() {
+	std::lock_guard< std::mutex > guard(sample_cache_mutex);
+	size_t total = 0;
+	for (auto const &fc : sample_cache) {
+		total += fc.second.sample->resident_bytes();
+	}
+	return total;
+}
+
+//------------------
 
 void Sound::init() {
 	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
@@ -60,15 +311,27 @@ void Sound::init() {
 		return;
 	}
 
+	open_device();
+	if (device != 0) {
+		std::cout << "Audio output initialized." << std::endl;
+	}
+}
+
+void open_device() {
+	assert(device == 0);
+
 	//Based on the example on https://wiki.libsdl.org/SDL_OpenAudioDevice
 	SDL_AudioSpec want, have;
 	SDL_zero(want);
 	want.freq = AUDIO_RATE;
 	want.format = AUDIO_F32SYS;
 	want.channels = 2;
-	want.samples = MIX_SAMPLES;
+	want.samples = Uint16(block_samples);
 	want.callback = mix_audio;
 
+	//(no callback is running, so the callback's own state can be reset here)
+	previous_callback_start = 0;
+
 	device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
 	if (device == 0) {
 		std::cerr << "Failed to open audio device:\n" << SDL_GetError() << std::endl;
@@ -76,10 +339,29 @@ void Sound::init() {
 	} else {
 		//start audio playback:
 		SDL_PauseAudioDevice(device, 0);
-		std::cout << "Audio output initialized." << std::endl;
 	}
 }
 
+void Sound::set_block_size(uint32_t samples) {
+	//round up to a power of two in [MinBlockSize, MaxBlockSize]:
+	uint32_t rounded = MinBlockSize;
+	while (rounded < samples && rounded < MaxBlockSize) rounded *= 2;
+	if (rounded == block_samples) return;
+	block_samples = rounded;
+
+	if (device != 0) {
+		//SDL can't change the block size of an open device, so re-open it:
+		SDL_PauseAudioDevice(device, 1);
+		SDL_CloseAudioDevice(device);
+		device = 0;
+		open_device();
+	}
+}
+
+uint32_t Sound::get_block_size() {
+	return block_samples;
+}
+
 
 void Sound::shutdown() {
 	if (device != 0) {
@@ -88,6 +370,7 @@ void Sound::shutdown() {
 		SDL_CloseAudioDevice(device);
 		device = 0;
 	}
+	set_mix_workers(0);
 }
 
 
@@ -99,24 +382,44 @@ void Sound::unlock() {
 	if (device) SDL_UnlockAudioDevice(device);
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play(Sample const &sample, float volume, float pan) {
+std::shared_ptr< Sound::PlayingSample > Sound::play(Sample const &sample, float volume, float pan, int32_t priority, std::shared_ptr< Bus > const &bus) {
+	return play_at(0, sample, volume, pan, priority, bus);
+}
+
+std::shared_ptr< Sound::PlayingSample > Sound::play_3D(Sample const &sample, float volume, glm::vec3 const &position, float half_volume_radius, int32_t priority, std::shared_ptr< Bus > const &bus) {
+	return play_3D_at(0, sample, volume, position, half_volume_radius, priority, bus);
+}
+
+uint64_t Sound::get_sample_clock() {
+	return sample_clock.load(std::memory_order_relaxed);
+}
+
+std::shared_ptr< Sound::PlayingSample > Sound::play_at(uint64_t time, Sample const &sample, float volume, float pan, int32_t priority, std::shared_ptr< Bus > const &bus) {
 	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, volume, pan, false);
+	playing_sample->priority = priority;
+	playing_sample->bus = bus;
+	playing_sample->start_time = time;
 	lock();
 	playing_samples.emplace_back(playing_sample);
 	unlock();
 	return playing_sample;
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play_3D(Sample const &sample, float volume, glm::vec3 const &position, float half_volume_radius) {
+std::shared_ptr< Sound::PlayingSample > Sound::play_3D_at(uint64_t time, Sample const &sample, float volume, glm::vec3 const &position, float half_volume_radius, int32_t priority, std::shared_ptr< Bus > const &bus) {
 	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, volume, position, half_volume_radius, false);
+	playing_sample->priority = priority;
+	playing_sample->bus = bus;
+	playing_sample->start_time = time;
 	lock();
 	playing_samples.emplace_back(playing_sample);
 	unlock();
 	return playing_sample;
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop(Sample const &sample, float volume, float pan) {
+std::shared_ptr< Sound::PlayingSample > Sound::loop(Sample const &sample, float volume, float pan, int32_t priority, std::shared_ptr< Bus > const &bus) {
 	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, volume, pan, true);
+	playing_sample->priority = priority;
+	playing_sample->bus = bus;
 	lock();
 	playing_samples.emplace_back(playing_sample);
 	unlock();
@@ -125,8 +428,10 @@ std::shared_ptr< Sound::PlayingSample > Sound::loop(Sample const &sample, float
 
 
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop_3D(Sample const &sample, float volume, glm::vec3 const &position, float half_volume_radius) {
+std::shared_ptr< Sound::PlayingSample > Sound::loop_3D(Sample const &sample, float volume, glm::vec3 const &position, float half_volume_radius, int32_t priority, std::shared_ptr< Bus > const &bus) {
 	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, volume, position, half_volume_radius, true);
+	playing_sample->priority = priority;
+	playing_sample->bus = bus;
 	lock();
 	playing_samples.emplace_back(playing_sample);
 	unlock();
@@ -134,6 +439,33 @@ std::shared_ptr< Sound::PlayingSample > Sound::loop_3D(Sample const &sample, flo
 }
 
 
+std::shared_ptr< Sound::Bus > Sound::make_bus(std::shared_ptr< Bus > const &parent) {
+	std::shared_ptr< Bus > bus = std::make_shared< Bus >(parent);
+	lock();
+	buses.emplace_back(bus);
+	unlock();
+	return bus;
+}
+
+void Sound::Bus::set_volume(float new_volume, float ramp) {
+	lock();
+	volume.set(new_volume, ramp);
+	unlock();
+}
+
+void Sound::Bus::add_effect(std::shared_ptr< Effect > const &effect) {
+	assert(effect);
+	lock();
+	effects.emplace_back(effect);
+	unlock();
+}
+
+void Sound::Bus::remove_effect(std::shared_ptr< Effect > const &effect) {
+	lock();
+	effects.erase(std::remove(effects.begin(), effects.end(), effect), effects.end());
+	unlock();
+}
+
 void Sound::stop_all_samples() {
 	lock();
 	for (auto &s : playing_samples) {
@@ -142,6 +474,79 @@ void Sound::stop_all_samples() {
 	unlock();
 }
 
+void Sound::set_limiter(bool enabled, float ceiling, float release) {
+	lock();
+	limiter_enabled = enabled;
+	limiter_ceiling = std::max(1.0e-3f, ceiling);
+	limiter_release = std::max(0.0f, release);
+	unlock();
+}
+
+Sound::MixerStats Sound::get_mixer_stats(bool reset) {
+	MixerStats stats;
+	if (reset) {
+		stats.peak_level = stat_peak_level.exchange(0.0f, std::memory_order_relaxed);
+		stats.limiter_gain = stat_limiter_gain.exchange(1.0f, std::memory_order_relaxed);
+		stats.clipped_samples = stat_clipped_samples.exchange(0, std::memory_order_relaxed);
+	} else {
+		stats.peak_level = stat_peak_level.load(std::memory_order_relaxed);
+		stats.limiter_gain = stat_limiter_gain.load(std::memory_order_relaxed);
+		stats.clipped_samples = stat_clipped_samples.load(std::memory_order_relaxed);
+	}
+	stats.callback_seconds = stat_callback_seconds.load(std::memory_order_relaxed);
+	stats.active_voices = stat_active_voices.load(std::memory_order_relaxed);
+	stats.playing_samples = stat_playing_samples.load(std::memory_order_relaxed);
+	return stats;
+}
+
+Sound::CallbackStats Sound::get_callback_stats() {
+	double tick = 1.0 / double(SDL_GetPerformanceFrequency());
+	CallbackStats stats;
+	for (uint32_t b = 0; b < CallbackStats::Buckets; ++b) {
+		stats.histogram[b] = timing_histogram[b].load(std::memory_order_relaxed);
+	}
+	stats.callbacks = timing_callbacks.load(std::memory_order_relaxed);
+	stats.budget_seconds = double(block_samples) / double(AUDIO_RATE);
+	stats.total_seconds = timing_total.load(std::memory_order_relaxed) * tick;
+	stats.max_seconds = timing_max.load(std::memory_order_relaxed) * tick;
+	stats.over_budget = timing_over_budget.load(std::memory_order_relaxed);
+	stats.late = timing_late.load(std::memory_order_relaxed);
+	stats.max_interval_seconds = timing_max_interval.load(std::memory_order_relaxed) * tick;
+	return stats;
+}
+
+void Sound::reset_callback_stats() {
+	//(a callback running concurrently may be counted partly before and partly after the reset)
+	for (auto &bucket : timing_histogram) {
+		bucket.store(0, std::memory_order_relaxed);
+	}
+	timing_callbacks.store(0, std::memory_order_relaxed);
+	timing_total.store(0, std::memory_order_relaxed);
+	timing_max.store(0, std::memory_order_relaxed);
+	timing_over_budget.store(0, std::memory_order_relaxed);
+	timing_late.store(0, std::memory_order_relaxed);
+	timing_max_interval.store(0, std::memory_order_relaxed);
+}
+
+void Sound::set_mix_threads(uint32_t threads) {
+	lock();
+	set_mix_workers(threads);
+	unlock();
+}
+
+void Sound::set_resample_quality(ResampleQuality quality) {
+	lock();
+	resample_quality = quality;
+	unlock();
+}
+
+void Sound::set_max_voices(uint32_t max_voices_, float threshold) {
+	lock();
+	max_voices = max_voices_;
+	audibility_threshold = threshold;
+	unlock();
+}
+
 void Sound::set_volume(float new_volume, float ramp) {
 	lock();
 	volume.set(new_volume, ramp);
@@ -179,6 +584,18 @@ void Sound::PlayingSample::set_half_volume_radius(float new_radius, float ramp)
 	Sound::unlock();
 }
 
+void Sound::PlayingSample::set_rate(float new_rate, float ramp) {
+	Sound::lock();
+	rate.set(std::max(0.0f, std::min(MaxRate, new_rate)), ramp);
+	Sound::unlock();
+}
+
+void Sound::PlayingSample::set_priority(int32_t new_priority) {
+	Sound::lock();
+	priority = new_priority;
+	Sound::unlock();
+}
+
 void Sound::PlayingSample::stop(float ramp) {
 	Sound::lock();
 	if (!(stopping || stopped)) {
@@ -219,37 +636,71 @@ inline void compute_pan_weights(float pan, float *left, float *right) {
 	*right = std::sin(ang);
 }
 
-//helper: 3D audio panning
-void compute_pan_from_listener_and_position(
-	glm::vec3 const &listener_position,
-	glm::vec3 const &listener_right,
-	glm::vec3 const &source_position,
-	float source_half_radius,
-	float *left, float *right
-	) {
-	glm::vec3 to = source_position - listener_position;
-	float distance = glm::length(to);
-	//start by panning based on direction.
-	//note that for a LR fade to sound uniform, sound power (squared magnitude) should remain constant.
-	if (distance == 0.0f) {
-		*left = *right = std::sqrt(2.0f);
-	} else {
-		//amt ranges from -1 (most left) to 1 (most right):
-		float amt = glm::dot(listener_right, to) / distance;
-		//turn into an angle from 0.0f (most left) to pi/2 (most right):
-		float ang = 0.5f * 3.1415926f * (0.5f * (amt + 1.0f));
-		*left = std::cos(ang);
-		*right = std::sin(ang);
+//helper: fast sin(x) for x in [0, pi/2] (odd Taylor polynomial; error < 2e-4, plenty for panning):
+inline float fast_sin_quarter(float x) {
+	float x2 = x * x;
+	return x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f + x2 * (-1.0f / 5040.0f))));
+}
+
+//helper: 3D audio panning, computed for a batch of sources at once.
+// Sources are stored structure-of-arrays style so the per-source loop has no branches or calls
+// and can be vectorized by the compiler:
+struct PanBatch {
+	std::vector< float > x, y, z, half_radius; //source positions and half-volume radii
+	std::vector< float > left, right; //computed gains
 
-		//squared distance attenuation is realistic if there are no walls,
-		// but I'm going to use linear because it's sounds better to me.
-		// (feel free to change it, of course)
-		//want att = 0.5f at distance == half_volume_radius
-		float att = 1.0f / (1.0f + (distance / source_half_radius));
-		*left *= att;
-		*right *= att;
+	void clear() {
+		x.clear(); y.clear(); z.clear(); half_radius.clear();
+	}
+	uint32_t push(glm::vec3 const &position, float half_radius_) {
+		x.emplace_back(position.x);
+		y.emplace_back(position.y);
+		z.emplace_back(position.z);
+		half_radius.emplace_back(half_radius_);
+		return uint32_t(x.size() - 1);
 	}
-}
+
+	void compute(glm::vec3 const &listener_position, glm::vec3 const &listener_right) {
+		uint32_t count = uint32_t(x.size());
+		left.resize(count);
+		right.resize(count);
+
+		float const *px = x.data(), *py = y.data(), *pz = z.data(), *pr = half_radius.data();
+		float *pl = left.data(), *prt = right.data();
+		float const lx = listener_position.x, ly = listener_position.y, lz = listener_position.z;
+		float const rx = listener_right.x, ry = listener_right.y, rz = listener_right.z;
+
+		//n.b. written without comparisons or std::min/max so that it vectorizes even with strict FP semantics
+		// (gcc/clang additionally need -fno-math-errno to vectorize the sqrt):
+		for (uint32_t i = 0; i < count; ++i) {
+			float tx = px[i] - lx, ty = py[i] - ly, tz = pz[i] - lz;
+			float distance = std::sqrt(tx * tx + ty * ty + tz * tz);
+			//(a source right at the listener gets amt == 0 here; its gains are replaced below)
+			float inv_distance = 1.0f / (distance + 1.0e-20f);
+
+			//start by panning based on direction.
+			//note that for a LR fade to sound uniform, sound power (squared magnitude) should remain constant.
+			//amt ranges from -1 (most left) to 1 (most right):
+			float amt = (rx * tx + ry * ty + rz * tz) * inv_distance;
+			//turn into an angle from 0.0f (most left) to pi/2 (most right):
+			float ang = 0.5f * 3.1415926f * (0.5f * (amt + 1.0f));
+
+			//squared distance attenuation is realistic if there are no walls,
+			// but I'm going to use linear because it's sounds better to me.
+			// (feel free to change it, of course)
+			//want att = 0.5f at distance == half_volume_radius
+			float att = 1.0f / (1.0f + (distance / pr[i]));
+
+			float l = fast_sin_quarter(0.5f * 3.1415926f - ang) * att;
+			float r = fast_sin_quarter(ang) * att;
+
+			//a source right at the listener gets sqrt(2) in both ears (blended arithmetically rather than branched, so this still vectorizes):
+			float at_listener = float(distance == 0.0f);
+			pl[i] = l + at_listener * (1.4142136f - l);
+			prt[i] = r + at_listener * (1.4142136f - r);
+		}
+	}
+};
 
 //helper: ramp updates...
 constexpr float const RAMP_STEP = float(MIX_SAMPLES) / float(AUDIO_RATE);
@@ -310,23 +761,244 @@ void step_direction_ramp(Sound::Ramp< glm::vec3 > &ramp) {
 }
 
 
-//The audio callback -- invoked by SDL when it needs more sound to play:
-void mix_audio(void *, Uint8 *buffer_, int len) {
-	assert(buffer_); //should always have some audio buffer
-
-	struct LR {
-		float l;
-		float r;
+//one stereo output sample:
+struct LR {
+	float l;
+	float r;
+};
+static_assert(sizeof(LR) == 8, "Sample is packed");
+
+//everything needed to mix one voice for one period, independent of the (mutable) PlayingSample:
+struct MixVoice {
+	std::shared_ptr< Sound::PlayingSample > keep_alive; //keeps the sample data alive while mixing off the callback thread
+	Sound::Sample const *sample = nullptr;
+	uint32_t i = 0; //position in sample at start of period...
+	float frac = 0.0f; //...plus this fraction of a sample
+	float start_rate = 1.0f, end_rate = 1.0f; //playback rate at start/end of period
+	Sound::ResampleQuality quality = Sound::ResampleLinear;
+	bool loop = false;
+	LR start_pan, end_pan; //gains at start/end of period
+	uint32_t bus = 0; //index of bus (in MixPlan::buses) to mix into
+	uint32_t offset = 0; //samples into the period at which the voice starts (for scheduled starts; otherwise 0)
+
+	//output samples this period:
+	uint32_t frames() const { return MIX_SAMPLES - offset; }
+
+	//playing at exactly the sample rate (so no resampling needed)?
+	bool unit_rate() const { return start_rate == 1.0f && end_rate == 1.0f && frac == 0.0f; }
+};
+
+//everything needed to mix one period -- built by plan_mix() on the callback thread:
+struct MixPlan {
+	struct Bus {
+		std::shared_ptr< Sound::Bus > bus; //(null for the output)
+		uint32_t parent = 0; //index of bus to mix into
+		float start_volume = 1.0f, end_volume = 1.0f;
 	};
-	static_assert(sizeof(LR) == 8, "Sample is packed");
-	assert(len == MIX_SAMPLES * sizeof(LR)); //should always have the expected number of samples
-	LR *buffer = reinterpret_cast< LR * >(buffer_);
+	//buses[0] is the output; the rest are ordered children-before-parents, so summing in order works:
+	std::vector< Bus > buses;
+	std::vector< MixVoice > voices;
 
-	//zero the output buffer:
-	for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
-		buffer[s].l = 0.0f;
-		buffer[s].r = 0.0f;
+	void clear() {
+		buses.clear();
+		voices.clear();
 	}
+};
+
+//helper: offset (in source samples, from the start of the period) of output sample k,
+// when playback rate ramps linearly from start_rate by rate_step per output sample:
+inline double rate_offset(double k, double start_rate, double rate_step) {
+	return k * start_rate + rate_step * 0.5 * k * (k - 1.0);
+}
+
+//helper: read 'count' samples starting at (possibly negative or past-the-end) index 'first',
+// wrapping around looping samples and reading silence outside non-looping ones:
+void gather_samples(Sound::Sample const &sample, bool loop, int64_t first, uint32_t count, float *out) {
+	int64_t length = sample.length;
+	while (count > 0) {
+		uint32_t n;
+		if (loop) {
+			int64_t at = ((first % length) + length) % length;
+			n = uint32_t(std::min< int64_t >(count, length - at));
+			sample.read(uint32_t(at), n, out);
+		} else if (first < 0 || first >= length) {
+			n = (first < 0 ? uint32_t(std::min< int64_t >(count, -first)) : count);
+			std::fill(out, out + n, 0.0f);
+		} else {
+			n = uint32_t(std::min< int64_t >(count, length - first));
+			sample.read(uint32_t(first), n, out);
+		}
+		out += n;
+		first += n;
+		count -= n;
+	}
+}
+
+//windowed-sinc resampling uses SINC_TAPS source samples (SINC_TAPS/2 - 1 before the cursor, SINC_TAPS/2 after),
+// weighted by a table of kernels at SINC_PHASES fractional offsets:
+constexpr uint32_t const SINC_TAPS = 8;
+constexpr uint32_t const SINC_PHASES = 64;
+struct SincTable {
+	float weights[SINC_PHASES + 1][SINC_TAPS];
+	SincTable() {
+		constexpr double const Pi = 3.14159265358979323846;
+		for (uint32_t p = 0; p <= SINC_PHASES; ++p) {
+			double frac = double(p) / SINC_PHASES;
+			double sum = 0.0;
+			for (uint32_t t = 0; t < SINC_TAPS; ++t) {
+				double x = double(t) - double(SINC_TAPS / 2 - 1) - frac;
+				double sinc = (x == 0.0 ? 1.0 : std::sin(Pi * x) / (Pi * x));
+				//Blackman window over [-SINC_TAPS/2, SINC_TAPS/2]:
+				double w = 2.0 * Pi * (x / SINC_TAPS + 0.5);
+				double window = 0.42 - 0.5 * std::cos(w) + 0.08 * std::cos(2.0 * w);
+				weights[p][t] = float(sinc * window);
+				sum += sinc * window;
+			}
+			//normalize so DC passes at unit gain:
+			for (uint32_t t = 0; t < SINC_TAPS; ++t) {
+				weights[p][t] = float(weights[p][t] / sum);
+			}
+		}
+	}
+};
+
+//helper: fill data[0 .. count) with the voice's period resampled to the output rate; returns count:
+uint32_t resample_voice(MixVoice const &voice, float *data) {
+	Sound::Sample const &sample = *voice.sample;
+	uint32_t const frames = voice.frames();
+	float rate_step = (voice.end_rate - voice.start_rate) / frames;
+
+	//gather every source sample the kernels will touch into a contiguous buffer:
+	constexpr uint32_t const Before = SINC_TAPS / 2 - 1;
+	double last = voice.frac + rate_offset(frames - 1, voice.start_rate, rate_step);
+	uint32_t span = uint32_t(std::floor(last)) + SINC_TAPS + 1;
+	static thread_local std::vector< float > source; //(thread_local since workers resample in parallel)
+	source.resize(span);
+	gather_samples(sample, voice.loop, int64_t(voice.i) - Before, span, source.data());
+
+	//non-looping samples stop when the cursor passes the end:
+	uint32_t count = frames;
+	if (!voice.loop) {
+		while (count > 0 && voice.i + voice.frac + rate_offset(count - 1, voice.start_rate, rate_step) >= sample.length) {
+			--count;
+		}
+	}
+
+	//positions are computed directly from k (rather than accumulated) so each output sample is independent,
+	// which lets the compiler vectorize these loops:
+	float const base = float(Before) + voice.frac;
+	float const r0 = voice.start_rate;
+	float const half_step = 0.5f * rate_step;
+	float const *src = source.data();
+	if (voice.quality == Sound::ResampleSinc) {
+		static SincTable const table;
+		for (uint32_t k = 0; k < count; ++k) {
+			float fk = float(k);
+			float pos = base + fk * r0 + half_step * fk * (fk - 1.0f);
+			int32_t j = int32_t(pos);
+			int32_t phase = int32_t((pos - float(j)) * SINC_PHASES + 0.5f);
+			float const *w = table.weights[phase];
+			float const *s = src + (j - int32_t(Before));
+			float acc = 0.0f;
+			for (uint32_t t = 0; t < SINC_TAPS; ++t) {
+				acc += s[t] * w[t];
+			}
+			data[k] = acc;
+		}
+	} else {
+		for (uint32_t k = 0; k < count; ++k) {
+			float fk = float(k);
+			float pos = base + fk * r0 + half_step * fk * (fk - 1.0f);
+			int32_t j = int32_t(pos);
+			float f = pos - float(j);
+			data[k] = src[j] + f * (src[j + 1] - src[j]);
+		}
+	}
+	return count;
+}
+
+//helper: add one voice's period into buffer[voice.offset .. MIX_SAMPLES):
+void mix_voice(MixVoice const &voice, LR *buffer) {
+	Sound::Sample const &sample = *voice.sample;
+	assert(voice.i < sample.length);
+	assert(voice.offset < MIX_SAMPLES);
+	uint32_t const frames = voice.frames();
+	buffer += voice.offset;
+
+	//figure out a step to add at each sample so that pan will move smoothly from start to end:
+	LR pan = voice.start_pan;
+	LR pan_step;
+	pan_step.l = (voice.end_pan.l - voice.start_pan.l) / frames;
+	pan_step.r = (voice.end_pan.r - voice.start_pan.r) / frames;
+
+	//convert this period's worth of sample data (however it is stored) to floating point:
+	float data[MIX_SAMPLES];
+	uint32_t count = 0;
+	if (voice.unit_rate()) {
+		uint32_t i = voice.i;
+		while (count < frames) {
+			uint32_t n = std::min(frames - count, sample.length - i);
+			sample.read(i, n, data + count);
+			count += n;
+
+			//update position in sample:
+			i += n;
+			if (i == sample.length) {
+				if (voice.loop) {
+					i = 0;
+				} else {
+					break;
+				}
+			}
+		}
+	} else {
+		count = resample_voice(voice, data);
+	}
+
+	for (uint32_t s = 0; s < count; ++s) {
+		//mix one sample based on current pan values:
+		buffer[s].l += pan.l * data[s];
+		buffer[s].r += pan.r * data[s];
+
+		//update pan values:
+		pan.l += pan_step.l;
+		pan.r += pan_step.r;
+	}
+}
+
+//helper: step all ramps by one period, decide which voices to mix, advance every voice's position,
+// and retire finished voices; buses and voices to mix are stored in 'plan':
+void plan_mix(MixPlan *plan) {
+	assert(plan);
+	plan->clear();
+
+	//snapshot the bus graph (dropping buses nobody references any more):
+	buses.erase(std::remove_if(buses.begin(), buses.end(), [](std::weak_ptr< Sound::Bus > const &b){
+		return b.expired();
+	}), buses.end());
+	plan->buses.emplace_back(); //the output
+	for (auto b = buses.rbegin(); b != buses.rend(); ++b) {
+		std::shared_ptr< Sound::Bus > bus = b->lock();
+		if (!bus) continue;
+		bus->mix_index = uint32_t(plan->buses.size());
+		plan->buses.emplace_back();
+		MixPlan::Bus &entry = plan->buses.back();
+		entry.bus = bus;
+		entry.start_volume = bus->volume.value;
+		step_value_ramp(bus->volume);
+		entry.end_volume = bus->volume.value;
+	}
+	for (auto &entry : plan->buses) {
+		//(parents were created first, so have already been given a higher index)
+		if (entry.bus && entry.bus->parent) entry.parent = entry.bus->parent->mix_index;
+	}
+
+	//this period covers sample clock times [clock, period_end); samples scheduled later are left for later periods:
+	uint64_t clock = sample_clock.load(std::memory_order_relaxed);
+	uint64_t period_end = clock + MIX_SAMPLES;
+	auto scheduled_later = [period_end](Sound::PlayingSample const &playing_sample) {
+		return playing_sample.start_time >= period_end;
+	};
 
 	//update global values:
 	float start_volume = Sound::volume.value;
@@ -341,79 +1013,177 @@ void mix_audio(void *, Uint8 *buffer_, int len) {
 	glm::vec3 end_position =  Sound::listener.position.value;
 	glm::vec3 end_right =  Sound::listener.right.value;
 
-	//add audio from each playing sample into the buffer:
-	for (auto si = playing_samples.begin(); si != playing_samples.end(); /* later */) {
-		Sound::PlayingSample &playing_sample = **si; //much more convenient than writing ** everywhere.
+	//figure out each playing sample's panning/volume over this mix period:
+	struct Voice {
+		Sound::PlayingSample *playing_sample;
+		LR start_pan, end_pan;
+		float start_gain, end_gain; //volume at start/end of period
+		float start_rate, end_rate; //playback rate at start/end of period
+		uint32_t batch_index; //index in start/end PanBatch (3D samples), or -1U (2D samples)
+		uint32_t offset; //samples into the period at which playback starts
+		float audibility; //loudest gain over the period
+		bool mix;
+	};
+	static std::vector< Voice > voices; //(static to avoid re-allocating every callback)
+	static PanBatch start_batch, end_batch; //3D samples' positions at start/end of period
+	voices.clear();
+	start_batch.clear();
+	end_batch.clear();
+	for (auto const &ps : playing_samples) {
+		Sound::PlayingSample &playing_sample = *ps; //much more convenient than writing * everywhere.
+		if (scheduled_later(playing_sample)) continue;
+		voices.emplace_back();
+		Voice &voice = voices.back();
+		voice.playing_sample = &playing_sample;
+		voice.batch_index = -1U;
+		voice.offset = (playing_sample.start_time > clock ? uint32_t(playing_sample.start_time - clock) : 0);
 
 		//Figure out sample panning/volume at start...
-		LR start_pan;
 		if (!(playing_sample.pan.value == playing_sample.pan.value)) {
-			//3D panning
-			compute_pan_from_listener_and_position(
-				start_position, start_right,
-				playing_sample.position.value,
-				playing_sample.half_volume_radius.value,
-				&start_pan.l, &start_pan.r);
+			//3D panning (computed in a batch, below)
+			voice.batch_index = start_batch.push(playing_sample.position.value, playing_sample.half_volume_radius.value);
 
 			step_position_ramp(playing_sample.position);
 			step_value_ramp(playing_sample.half_volume_radius);
 		} else {
 			//2D panning
-			compute_pan_weights(playing_sample.pan.value, &start_pan.l, &start_pan.r);
+			compute_pan_weights(playing_sample.pan.value, &voice.start_pan.l, &voice.start_pan.r);
 
 			step_value_ramp(playing_sample.pan);
 		}
-		start_pan.l *= start_volume * playing_sample.volume.value;
-		start_pan.r *= start_volume * playing_sample.volume.value;
+		voice.start_gain = start_volume * playing_sample.volume.value;
+		voice.start_rate = playing_sample.rate.value;
 
 		step_value_ramp(playing_sample.volume);
+		step_value_ramp(playing_sample.rate);
 
 		//..and end of the mix period:
-		LR end_pan;
-		if (!(playing_sample.pan.value == playing_sample.pan.value)) {
+		if (voice.batch_index != -1U) {
 			//3D panning
-			compute_pan_from_listener_and_position(
-				end_position, end_right,
-				playing_sample.position.value,
-				playing_sample.half_volume_radius.value,
-				&end_pan.l, &end_pan.r);
+			end_batch.push(playing_sample.position.value, playing_sample.half_volume_radius.value);
 		} else {
 			//2D panning
-			compute_pan_weights(playing_sample.pan.value, &end_pan.l, &end_pan.r);
+			compute_pan_weights(playing_sample.pan.value, &voice.end_pan.l, &voice.end_pan.r);
 		}
+		voice.end_gain = end_volume * playing_sample.volume.value;
+		voice.end_rate = playing_sample.rate.value;
+	}
 
-		end_pan.l *= end_volume * playing_sample.volume.value;
-		end_pan.r *= end_volume * playing_sample.volume.value;
-
-		//figure out a step to add at each sample so that pan will move smoothly from start to end:
-		LR pan = start_pan;
-		LR pan_step;
-		pan_step.l = (end_pan.l - start_pan.l) / MIX_SAMPLES;
-		pan_step.r = (end_pan.r - start_pan.r) / MIX_SAMPLES;
-
-		assert(playing_sample.i < playing_sample.data.size());
+	start_batch.compute(start_position, start_right);
+	end_batch.compute(end_position, end_right);
 
-		for (uint32_t i = 0; i < MIX_SAMPLES; ++i) {
-			//mix one sample based on current pan values:
-			buffer[i].l += pan.l * playing_sample.data[playing_sample.i];
-			buffer[i].r += pan.r * playing_sample.data[playing_sample.i];
+	for (auto &voice : voices) {
+		if (voice.batch_index != -1U) {
+			voice.start_pan.l = start_batch.left[voice.batch_index];
+			voice.start_pan.r = start_batch.right[voice.batch_index];
+			voice.end_pan.l = end_batch.left[voice.batch_index];
+			voice.end_pan.r = end_batch.right[voice.batch_index];
+		}
+		voice.start_pan.l *= voice.start_gain;
+		voice.start_pan.r *= voice.start_gain;
+		voice.end_pan.l *= voice.end_gain;
+		voice.end_pan.r *= voice.end_gain;
+
+		//pan interpolates linearly, so the loudest point is at one end:
+		voice.audibility = std::max(
+			std::max(std::abs(voice.start_pan.l), std::abs(voice.start_pan.r)),
+			std::max(std::abs(voice.end_pan.l), std::abs(voice.end_pan.r))
+		);
+		voice.mix = false;
+	}
 
-			//update position in sample:
-			playing_sample.i += 1;
-			if (playing_sample.i == playing_sample.data.size()) {
-				if (playing_sample.loop) {
-					playing_sample.i = 0;
-				} else {
-					break;
+	{ //mix only audible voices, and of those at most max_voices (highest priority, then loudest):
+		static std::vector< Voice * > audible;
+		audible.clear();
+		for (auto &voice : voices) {
+			if (voice.audibility >= audibility_threshold) audible.emplace_back(&voice);
+		}
+		if (audible.size() > max_voices) {
+			std::nth_element(audible.begin(), audible.begin() + max_voices, audible.end(), [](Voice const *a, Voice const *b) {
+				if (a->playing_sample->priority != b->playing_sample->priority) {
+					return a->playing_sample->priority > b->playing_sample->priority;
 				}
+				return a->audibility > b->audibility;
+			});
+			audible.resize(max_voices);
+		}
+		for (auto voice : audible) {
+			voice->mix = true;
+		}
+	}
+
+	//hand off audible samples for mixing and advance all samples by one period:
+	auto vi = voices.begin();
+	for (auto si = playing_samples.begin(); si != playing_samples.end(); /* later */) {
+		Sound::PlayingSample &playing_sample = **si;
+		if (scheduled_later(playing_sample)) {
+			if (playing_sample.stopping) {
+				//stopped before it started:
+				playing_sample.stopped = true;
+				si = playing_samples.erase(si);
+			} else {
+				++si;
 			}
+			continue;
+		}
+		assert(vi != voices.end());
+		assert(vi->playing_sample == &playing_sample);
+
+		assert(playing_sample.i < playing_sample.sample.length);
+
+		LR start_pan = vi->start_pan;
+		LR end_pan = vi->end_pan;
+		bool mix = vi->mix;
+		if (mix && playing_sample.voice == Sound::PlayingSample::Virtual) {
+			//coming back from virtual, so fade in:
+			start_pan.l = start_pan.r = 0.0f;
+		} else if (!mix && playing_sample.voice == Sound::PlayingSample::Audible) {
+			//just went virtual, so mix once more fading out (avoids a click when cut by the voice limit):
+			end_pan.l = end_pan.r = 0.0f;
+			mix = true;
+		}
+		playing_sample.voice = (vi->mix ? Sound::PlayingSample::Audible : Sound::PlayingSample::Virtual);
+
+		if (mix) {
+			plan->voices.emplace_back();
+			MixVoice &voice = plan->voices.back();
+			voice.keep_alive = *si;
+			voice.sample = &playing_sample.sample;
+			voice.i = playing_sample.i;
+			voice.frac = playing_sample.frac;
+			voice.start_rate = vi->start_rate;
+			voice.end_rate = vi->end_rate;
+			voice.quality = resample_quality;
+			voice.loop = playing_sample.loop;
+			voice.start_pan = start_pan;
+			voice.end_pan = end_pan;
+			voice.bus = (playing_sample.bus ? playing_sample.bus->mix_index : 0);
+			voice.offset = vi->offset;
+		}
 
-			//update pan values:
-			pan.l += pan_step.l;
-			pan.r += pan_step.r;
+		//update position in sample:
+		uint32_t length = playing_sample.sample.length;
+		uint32_t frames = MIX_SAMPLES - vi->offset;
+		if (vi->start_rate == 1.0f && vi->end_rate == 1.0f && playing_sample.frac == 0.0f) {
+			if (playing_sample.loop) {
+				playing_sample.i = uint32_t((uint64_t(playing_sample.i) + frames) % length);
+			} else {
+				playing_sample.i = uint32_t(std::min< uint64_t >(uint64_t(playing_sample.i) + frames, length));
+			}
+		} else {
+			//(same positions as resample_voice uses)
+			double rate_step = (double(vi->end_rate) - double(vi->start_rate)) / frames;
+			double at = playing_sample.i + double(playing_sample.frac) + rate_offset(frames, vi->start_rate, rate_step);
+			if (playing_sample.loop) {
+				at = std::fmod(at, double(length));
+			} else {
+				at = std::min(at, double(length));
+			}
+			playing_sample.i = std::min(uint32_t(at), length);
+			playing_sample.frac = (playing_sample.i == length ? 0.0f : float(at - playing_sample.i));
 		}
 
-		if (playing_sample.i >= playing_sample.data.size()
+		if (playing_sample.i >= playing_sample.sample.length
 		 || (playing_sample.stopping && playing_sample.volume.value == 0.0f)) { //sample has finished
 		 	playing_sample.stopped = true;
 			//erase from list:
@@ -423,16 +1193,320 @@ void mix_audio(void *, Uint8 *buffer_, int len) {
 		} else {
 			++si;
 		}
+		++vi;
+	}
+
+	sample_clock.store(period_end, std::memory_order_relaxed);
+}
+
+//helper: run the summed input of every bus ('mix', MIX_SAMPLES per bus) through its effects and volume,
+// adding each bus into its parent and finally the output (bus 0) into 'buffer':
+void mix_buses(MixPlan const &plan, LR *mix, LR *buffer) {
+	for (uint32_t b = 1; b < plan.buses.size(); ++b) {
+		MixPlan::Bus const &entry = plan.buses[b];
+		assert(entry.parent == 0 || entry.parent > b);
+		LR *bus_mix = mix + b * MIX_SAMPLES;
+
+		for (auto const &effect : entry.bus->effects) {
+			effect->process(&bus_mix[0].l, MIX_SAMPLES);
+		}
+
+		float volume = entry.start_volume;
+		float volume_step = (entry.end_volume - entry.start_volume) / MIX_SAMPLES;
+		float peak = 0.0f;
+		LR *parent_mix = mix + entry.parent * MIX_SAMPLES;
+		for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
+			LR out{bus_mix[s].l * volume, bus_mix[s].r * volume};
+			peak = std::max(peak, std::max(std::abs(out.l), std::abs(out.r)));
+			parent_mix[s].l += out.l;
+			parent_mix[s].r += out.r;
+			volume += volume_step;
+		}
+		entry.bus->level.store(peak, std::memory_order_relaxed);
 	}
 
-	/*//DEBUG: report output power:
-	float max_power = 0.0f;
 	for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
-		max_power = std::max(max_power, (buffer[s].l * buffer[s].l + buffer[s].r * buffer[s].r));
+		buffer[s].l += mix[s].l;
+		buffer[s].r += mix[s].r;
+	}
+}
+
+//Look-ahead peak limiter for the output: the output is delayed by Lookahead samples
+// so that gain can already be reduced by the time a peak arrives:
+struct Limiter {
+	static constexpr uint32_t const Lookahead = 72; //1.5ms
+
+	//ring buffer of delayed output, with the gain each sample needs to stay under the ceiling:
+	LR delayed[Lookahead] = {};
+	float needed[Lookahead] = {};
+	uint32_t at = 0;
+
+	//running minimum of 'needed' over the look-ahead window (a monotonic queue, stored in a ring):
+	struct Entry {
+		uint64_t index;
+		float needed;
+	};
+	Entry window[Lookahead + 1];
+	uint32_t window_begin = 0, window_size = 0;
+	uint64_t index = 0; //samples processed so far
+
+	float gain = 1.0f;
+
+	Limiter() {
+		std::fill(needed, needed + Lookahead, 1.0f);
+	}
+
+	//limit buffer[0 .. count) in place; returns smallest gain used:
+	float process(LR *buffer, uint32_t count, float ceiling, float release) {
+		//reach the needed gain within (about) the look-ahead time, and recover over the release time:
+		float const attack_coef = std::exp(-5.0f / float(Lookahead));
+		float const release_coef = std::exp(-1.0f / (std::max(1.0e-4f, release) * AUDIO_RATE));
+
+		float min_gain = 1.0f;
+		for (uint32_t s = 0; s < count; ++s) {
+			LR in = buffer[s];
+			float peak = std::max(std::abs(in.l), std::abs(in.r));
+			float need = (peak > ceiling ? ceiling / peak : 1.0f);
+
+			//add to window (dropping entries that can no longer be the minimum) and drop expired entries:
+			while (window_size > 0 && window[(window_begin + window_size - 1) % (Lookahead + 1)].needed >= need) {
+				--window_size;
+			}
+			window[(window_begin + window_size) % (Lookahead + 1)] = Entry{index, need};
+			++window_size;
+			while (window[window_begin].index + Lookahead < index) {
+				window_begin = (window_begin + 1) % (Lookahead + 1);
+				--window_size;
+			}
+			float target = window[window_begin].needed;
+
+			gain = target + (gain - target) * (target < gain ? attack_coef : release_coef);
+
+			//output the delayed sample (clamping gain in case the attack hasn't quite caught up):
+			LR out = delayed[at];
+			float g = std::min(gain, needed[at]);
+			buffer[s].l = out.l * g;
+			buffer[s].r = out.r * g;
+			min_gain = std::min(min_gain, g);
+
+			delayed[at] = in;
+			needed[at] = need;
+			at = (at + 1) % Lookahead;
+			++index;
+		}
+		return min_gain;
+	}
+};
+
+//Worker pool for mixing voices off the callback thread (see Sound::set_mix_threads):
+// each callback collects the partial mixes started by the previous callback
+// and then starts the workers on the next block, so they have a whole block to finish.
+struct MixWorkers {
+	MixWorkers(uint32_t count) {
+		scratch.resize(count);
+		for (uint32_t w = 0; w < count; ++w) {
+			threads.emplace_back(&MixWorkers::work, this, w);
+		}
+	}
+	~MixWorkers() {
+		{
+			std::unique_lock< std::mutex > lock(mutex);
+			done_cv.wait(lock, [this](){ return pending == 0; });
+			quit = true;
+		}
+		start_cv.notify_all();
+		for (auto &thread : threads) {
+			thread.join();
+		}
+	}
+
+	//wait for the block started by the last start() and add (up to) 'periods' periods of it into buffer:
+	void finish(LR *buffer, uint32_t periods) {
+		{
+			std::unique_lock< std::mutex > lock(mutex);
+			done_cv.wait(lock, [this](){ return pending == 0; });
+		}
+		//(the block size changes only when the device is re-opened, so at most one block is cut short)
+		periods = std::min(periods, planned);
+		for (uint32_t p = 0; p < periods; ++p) {
+			//sum the per-worker partial bus mixes, then run the buses:
+			mix.assign(plans[p].buses.size() * MIX_SAMPLES, LR{0.0f, 0.0f});
+			for (auto const &partials : scratch) {
+				std::vector< LR > const &partial = partials[p];
+				assert(partial.size() == mix.size());
+				for (size_t s = 0; s < mix.size(); ++s) {
+					mix[s].l += partial[s].l;
+					mix[s].r += partial[s].r;
+				}
+			}
+			mix_buses(plans[p], mix.data(), buffer + p * MIX_SAMPLES);
+		}
+		for (auto &plan : plans) {
+			plan.clear();
+		}
+		planned = 0;
+	}
+
+	//start mixing the first 'periods' plans (in the background):
+	void start(uint32_t periods) {
+		assert(periods <= plans.size());
+		{
+			std::unique_lock< std::mutex > lock(mutex);
+			planned = periods;
+			pending = uint32_t(threads.size());
+			++generation;
+		}
+		start_cv.notify_all();
+	}
+
+	void work(uint32_t w) {
+		uint64_t seen = 0;
+		while (true) {
+			{
+				std::unique_lock< std::mutex > lock(mutex);
+				start_cv.wait(lock, [&](){ return quit || generation != seen; });
+				if (quit) return;
+				seen = generation;
+			}
+
+			//each worker mixes every threads.size()'th voice into its own per-bus scratch buffers:
+			std::vector< std::vector< LR > > &partials = scratch[w];
+			if (partials.size() < planned) partials.resize(planned);
+			for (uint32_t p = 0; p < planned; ++p) {
+				MixPlan const &plan = plans[p];
+				partials[p].assign(plan.buses.size() * MIX_SAMPLES, LR{0.0f, 0.0f});
+				for (size_t v = w; v < plan.voices.size(); v += threads.size()) {
+					mix_voice(plan.voices[v], partials[p].data() + plan.voices[v].bus * MIX_SAMPLES);
+				}
+			}
+
+			std::unique_lock< std::mutex > lock(mutex);
+			pending -= 1;
+			if (pending == 0) done_cv.notify_all();
+		}
 	}
-	std::cout << "Max Power: " << std::sqrt(max_power) << "; playing samples: " << playing_samples.size() << std::endl; //DEBUG
-	*/
 
+	std::vector< MixPlan > plans; //the periods of the block being mixed (only modified while workers are idle)
+	uint32_t planned = 0; //number of plans in use
+	std::vector< std::vector< std::vector< LR > > > scratch; //per-worker, per-period partial mix (MIX_SAMPLES per bus)
+	std::vector< LR > mix; //sum of partial mixes
+	std::vector< std::thread > threads;
+
+	std::mutex mutex;
+	std::condition_variable start_cv, done_cv;
+	uint64_t generation = 0; //incremented by start()
+	uint32_t pending = 0; //workers still mixing the current generation
+	bool quit = false;
+};
+
+//helper: add the timing of one callback (which produced 'samples' samples) to the telemetry:
+void record_callback_timing(uint32_t samples, Uint64 start, Uint64 end) {
+	Uint64 frequency = SDL_GetPerformanceFrequency();
+	Uint64 budget = frequency * samples / AUDIO_RATE;
+	Uint64 duration = end - start;
+
+	auto store_max = [](std::atomic< uint64_t > &at, uint64_t value) {
+		//(only the callback raises these, but resets may race, so compare-and-swap)
+		uint64_t old = at.load(std::memory_order_relaxed);
+		while (value > old && !at.compare_exchange_weak(old, value, std::memory_order_relaxed)) { }
+	};
+
+	stat_callback_seconds.store(float(double(duration) / double(frequency)), std::memory_order_relaxed);
+
+	uint64_t microseconds = duration * 1000000 / frequency;
+	uint32_t bucket = 0;
+	while (bucket + 1 < Sound::CallbackStats::Buckets && (microseconds >> (bucket + 1)) != 0) ++bucket;
+	timing_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+	timing_callbacks.fetch_add(1, std::memory_order_relaxed);
+	timing_total.fetch_add(duration, std::memory_order_relaxed);
+	store_max(timing_max, duration);
+	if (duration > budget) timing_over_budget.fetch_add(1, std::memory_order_relaxed);
+
+	if (previous_callback_start != 0) {
+		Uint64 interval = start - previous_callback_start;
+		store_max(timing_max_interval, interval);
+		if (interval > budget + budget / 2) timing_late.fetch_add(1, std::memory_order_relaxed);
+	}
+	previous_callback_start = start;
 }
 
+//The audio callback -- invoked by SDL when it needs more sound to play:
+void mix_audio(void *, Uint8 *buffer_, int len) {
+	assert(buffer_); //should always have some audio buffer
 
+	assert(len % (MIX_SAMPLES * sizeof(LR)) == 0); //should always be a whole number of periods
+	LR *buffer = reinterpret_cast< LR * >(buffer_);
+	uint32_t samples = uint32_t(len / sizeof(LR));
+	uint32_t periods = samples / MIX_SAMPLES;
+
+	Uint64 callback_start = SDL_GetPerformanceCounter();
+
+	//zero the output buffer:
+	for (uint32_t s = 0; s < samples; ++s) {
+		buffer[s].l = 0.0f;
+		buffer[s].r = 0.0f;
+	}
+
+	//(each period steps ramps and pans on its own, so parameter changes land within a period no matter the block size)
+	if (mix_workers) {
+		//output the block the workers mixed since the last callback, then start them on the next one:
+		mix_workers->finish(buffer, periods);
+		if (mix_workers->plans.size() < periods) mix_workers->plans.resize(periods);
+		for (uint32_t p = 0; p < periods; ++p) {
+			plan_mix(&mix_workers->plans[p]);
+		}
+		stat_active_voices.store(uint32_t(mix_workers->plans[periods-1].voices.size()), std::memory_order_relaxed);
+		mix_workers->start(periods);
+	} else {
+		//mix everything right here:
+		static MixPlan plan; //(static to avoid re-allocating every callback)
+		static std::vector< LR > mix; //MIX_SAMPLES per bus
+		for (uint32_t p = 0; p < periods; ++p) {
+			plan_mix(&plan);
+			mix.assign(plan.buses.size() * MIX_SAMPLES, LR{0.0f, 0.0f});
+			for (auto const &voice : plan.voices) {
+				mix_voice(voice, mix.data() + voice.bus * MIX_SAMPLES);
+			}
+			mix_buses(plan, mix.data(), buffer + p * MIX_SAMPLES);
+			stat_active_voices.store(uint32_t(plan.voices.size()), std::memory_order_relaxed);
+		}
+		plan.clear();
+	}
+	stat_playing_samples.store(uint32_t(playing_samples.size()), std::memory_order_relaxed);
+
+	//measure output before limiting:
+	float peak = 0.0f;
+	uint32_t clipped = 0;
+	for (uint32_t s = 0; s < samples; ++s) {
+		float p = std::max(std::abs(buffer[s].l), std::abs(buffer[s].r));
+		peak = std::max(peak, p);
+		clipped += (std::abs(buffer[s].l) > 1.0f) + (std::abs(buffer[s].r) > 1.0f);
+	}
+
+	static Limiter limiter;
+	float limiter_gain = 1.0f;
+	if (limiter_enabled) {
+		limiter_gain = limiter.process(buffer, samples, limiter_ceiling, limiter_release);
+	}
+
+	//update telemetry:
+	// (the game thread may exchange these concurrently, so max/min are compare-and-swap loops)
+	float old_peak = stat_peak_level.load(std::memory_order_relaxed);
+	while (peak > old_peak && !stat_peak_level.compare_exchange_weak(old_peak, peak, std::memory_order_relaxed)) { }
+	float old_gain = stat_limiter_gain.load(std::memory_order_relaxed);
+	while (limiter_gain < old_gain && !stat_limiter_gain.compare_exchange_weak(old_gain, limiter_gain, std::memory_order_relaxed)) { }
+	stat_clipped_samples.fetch_add(clipped, std::memory_order_relaxed);
+
+	record_callback_timing(samples, callback_start, SDL_GetPerformanceCounter());
+}
+
+void set_mix_workers(uint32_t count) {
+	uint32_t current = (mix_workers ? uint32_t(mix_workers->threads.size()) : 0);
+	if (count == current) return;
+	//(any period the old workers were mixing is dropped)
+	delete mix_workers;
+	mix_workers = nullptr;
+	if (count > 0) {
+		mix_workers = new MixWorkers(count);
+	}
+}
@@ -3,26 +3,58 @@
 #include <glm/glm.hpp>
 
 #include <memory>
+#include <atomic>
 #include <vector>
 #include <string>
 #include <cmath>
+#include <cstdint>
 
 //Game audio system. Simplified from f18-base3.
 //Uses 48kHz sampling rate.
 
 namespace Sound {
 
+constexpr uint32_t const AUDIO_RATE = 48000; //sampling rate of all samples and of the output
+
 //Sample objects hold mono (one-channel) audio.
-struct Sample {
+// (samples shared through the sample cache -- see get_sample() below -- are owned by std::shared_ptr)
+struct Sample : std::enable_shared_from_this< Sample > {
+	//how sample data is kept in memory; the mixer converts to floating point as it plays:
+	enum Format : uint8_t {
+		Float32, //4 bytes/sample, in 'data'
+		Int16, //2 bytes/sample, in 'data_int16'
+		ADPCM, //~0.5 bytes/sample (IMA ADPCM blocks -- see adpcm.hpp), in 'data_adpcm'
+	};
+
 	//Load from a '.wav' or '.opus' file.
-	//  will warn and convert if sound is not already 48kHz mono:
-	Sample(std::string const &filename);
+	//  will warn and convert if sound is not already 48kHz mono.
+	//  if the on-disk cache is on (see pcm_cache.hpp), a cached copy is memory-mapped instead of decoding:
+	Sample(std::string const &filename, Format format = Float32);
 	
 	//Directly supply an audio buffer:
-	Sample(std::vector< float > const &data);
+	Sample(std::vector< float > const &data, Format format = Float32);
 
-	//sample data is stored as 48kHz, mono, floating-point:
+	//sample data is 48kHz, mono; only the vector matching 'format' is used:
+	Format format = Float32;
+	uint32_t length = 0; //in samples
 	std::vector< float > data;
+	std::vector< int16_t > data_int16;
+	std::vector< uint8_t > data_adpcm;
+	//...unless the data is memory-mapped from the on-disk cache, in which case it is here instead:
+	std::shared_ptr< void const > mapping; //(keeps the mapping open)
+	void const *mapped = nullptr;
+	size_t mapped_bytes = 0;
+
+	//convert samples [begin, begin + count) to floating point:
+	void read(uint32_t begin, uint32_t count, float *out) const;
+
+	//memory used by the sample data:
+	size_t resident_bytes() const;
+
+	//(used by the constructors) store floating-point data in 'format':
+	void store(std::vector< float > &&data, Format format);
+	//(used by the constructors) bytes of data 'length' samples take in 'format':
+	static size_t stored_bytes(Format format, uint32_t length);
 };
 
 //Ramp<> manages values that should be smoothly interpolated
@@ -43,11 +75,54 @@ struct Ramp {
 			ramp = ramp_;
 		}
 	}
+	//advance 'elapsed' seconds toward the target (used on the audio thread):
+	void step(float elapsed) {
+		if (ramp < elapsed) {
+			value = target;
+			ramp = 0.0f;
+		} else {
+			value += (target - value) * (elapsed / ramp);
+			ramp -= elapsed;
+		}
+	}
+
 	T value;
 	T target;
 	float ramp = 0.0f;
 };
 
+//Effects process the mixed audio of a bus (see below; standard effects are in SoundEffects.hpp):
+struct Effect {
+	virtual ~Effect() { }
+	//process 'frames' stereo frames (interleaved left, right) in place.
+	// called from the audio thread while the audio lock is held, so set parameters between Sound::lock() and Sound::unlock():
+	virtual void process(float *stereo, uint32_t frames) = 0;
+};
+
+//Buses sum a group of playing samples, run the result through a chain of effects, and apply a volume
+// before passing it to their parent bus (or to the output). Create them with Sound::make_bus().
+struct Bus {
+	void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
+
+	//add an effect to the end of this bus's chain (or remove one):
+	void add_effect(std::shared_ptr< Effect > const &effect);
+	void remove_effect(std::shared_ptr< Effect > const &effect);
+
+	//peak output level over the last mix period (after effects and volume -- handy for meters or side-chains):
+	float get_level() const { return level.load(std::memory_order_relaxed); }
+
+	//internals:
+	Bus(std::shared_ptr< Bus > const &parent_) : parent(parent_) { }
+	std::shared_ptr< Bus > const parent; //bus this one mixes into (null == output)
+	Ramp< float > volume = Ramp< float >(1.0f);
+	std::vector< std::shared_ptr< Effect > > effects;
+	std::atomic< float > level = ATOMIC_VAR_INIT(0.0f);
+	uint32_t mix_index = 0; //used by the mixer
+};
+
+//make a new bus that mixes into 'parent' (or the output, if null):
+std::shared_ptr< Bus > make_bus(std::shared_ptr< Bus > const &parent = nullptr);
+
 // 'PlayingSample' objects book-keep samples that are currently playing:
 struct PlayingSample {
 	//change the panning or volume of a playing sample (and do proper locking);
@@ -60,19 +135,39 @@ struct PlayingSample {
 	//set the half-volume radius (use only on "3D" playing sounds):
 	void set_half_volume_radius(float new_radius, float ramp = 1.0f / 60.0f);
 
+	//set the playback rate (1.0 == normal; 2.0 == twice as fast and an octave up; clamped to [0, MaxRate]):
+	void set_rate(float new_rate, float ramp = 1.0f / 60.0f);
+	static constexpr float MaxRate = 8.0f;
+
+	//set the priority used to pick which samples to mix when more than max_voices are audible:
+	void set_priority(int32_t new_priority);
+
 	//'stop' will fade sample out over 'ramp' seconds and then remove it from the active samples:
 	void stop(float ramp = 1.0f / 60.0f);
 
 	//internals:
 	//NOTE: PlayingSample is used in a separate thread; so setting these values directly
 	// may result in bad results. Instead, use the functions above, which perform locking!
-	std::vector< float > const &data; //reference to sample data being played
-	uint32_t i = 0; //next data value to read
+	Sample const &sample; //sample being played
+	std::shared_ptr< Bus > bus; //bus the sample mixes into (null == output)
+	std::shared_ptr< Sample const > sample_ref; //keeps a cached sample resident while it plays (null for samples not owned by a shared_ptr)
+	uint32_t i = 0; //next data value to read...
+	float frac = 0.0f; //...plus this fraction of a sample (only non-zero once played at a rate other than 1)
 	bool loop = false; //should playback loop after data runs out?
 	bool stopping = false; //is playing stopping?
 	bool stopped = false; //was playback stopped (either by running out of sample, or by stop())?
+	uint64_t start_time = 0; //sample clock time at which playback begins (see play_at)
+
+	int32_t priority = 0; //higher priority samples are mixed first when voices are limited
+	//virtual samples (too quiet, or over the voice limit) only advance their position rather than being mixed:
+	enum Voice : uint8_t {
+		Starting, //not yet mixed
+		Audible, //mixed in the last period
+		Virtual, //skipped in the last period
+	} voice = Starting;
 
 	Ramp< float > volume = Ramp< float >(1.0f);
+	Ramp< float > rate = Ramp< float >(1.0f); //playback rate (samples are resampled when not 1.0)
 
 	//2D playback panning control: ('NaN' if sound played in 3D mode)
 	Ramp< float > pan = Ramp< float >(std::numeric_limits< float >::quiet_NaN());
@@ -82,11 +177,33 @@ struct PlayingSample {
 	Ramp< float > half_volume_radius = std::numeric_limits< float >::quiet_NaN();
 
 	PlayingSample(Sample const &sample_, float volume_, float pan_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), pan(pan_) { }
+		: sample(sample_), sample_ref(sample_.weak_from_this().lock()), loop(loop_), volume(volume_), pan(pan_) { }
 	PlayingSample(Sample const &sample_, float volume_, glm::vec3 const &position_, float half_volume_radius_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), position(position_), half_volume_radius(half_volume_radius_) { }
+		: sample(sample_), sample_ref(sample_.weak_from_this().lock()), loop(loop_), volume(volume_), position(position_), half_volume_radius(half_volume_radius_) { }
 };
 
+// ------- sample cache -------
+
+//Call 'Sound::get_sample' to share one decoded copy of a sample file (loading it on first use).
+//  The sample stays resident as long as anything -- including a playing sound -- holds a reference.
+//  Unreferenced samples are kept for re-use until the cache is over budget,
+//  at which point the least-recently-used ones are freed.
+//  ('format' only matters if the sample wasn't already cached)
+std::shared_ptr< Sample const > get_sample(std::string const &filename, Sample::Format format = Sample::Float32);
+
+//memory budget (in bytes) for cached samples; samples still in use are never freed, so this may be exceeded:
+void set_sample_cache_budget(size_t bytes);
+size_t get_sample_cache_budget();
+
+//report on cached samples, most-recently-used first:
+struct SampleCacheInfo {
+	std::string filename;
+	size_t resident_bytes = 0;
+	long references = 0; //references outside the cache (0 == evictable)
+};
+std::vector< SampleCacheInfo > get_sample_cache_info();
+size_t get_sample_cache_resident_bytes();
+
 // ------- global functions -------
 
 void init(); //call Sound::init() from main.cpp before using any member functions
@@ -98,14 +215,42 @@ void shutdown(); //call Sound::shutdown() from main.cpp to gracefully(-ish) exit
 std::shared_ptr< PlayingSample > play(
 	Sample const &sample,
 	float volume = 1.0f,
-	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
+	float pan = 0.0f, //-1.0f == hard left, 1.0f == hard right
+	int32_t priority = 0,
+	std::shared_ptr< Bus > const &bus = nullptr //(null == straight to output)
 );
 //The play_3D version will play a sample in '3D' mode (that is, panning determined by listener position):
 std::shared_ptr< PlayingSample > play_3D(
 	Sample const &sample,
 	float volume,
 	glm::vec3 const &position,
-	float half_volume_radius = std::numeric_limits< float >::infinity()
+	float half_volume_radius = std::numeric_limits< float >::infinity(),
+	int32_t priority = 0,
+	std::shared_ptr< Bus > const &bus = nullptr //(null == straight to output)
+);
+
+//The mixer counts every sample it mixes; this "sample clock" can be used to schedule samples precisely.
+// (mixing runs a little ahead of what is heard, so samples scheduled at or after get_sample_clock() start on exactly that sample)
+// (read without locking; one second is AUDIO_RATE samples)
+uint64_t get_sample_clock();
+
+//Like 'play' and 'play_3D', but start playing at sample clock time 'time' (or as soon as possible, if that has passed):
+std::shared_ptr< PlayingSample > play_at(
+	uint64_t time,
+	Sample const &sample,
+	float volume = 1.0f,
+	float pan = 0.0f, //-1.0f == hard left, 1.0f == hard right
+	int32_t priority = 0,
+	std::shared_ptr< Bus > const &bus = nullptr //(null == straight to output)
+);
+std::shared_ptr< PlayingSample > play_3D_at(
+	uint64_t time,
+	Sample const &sample,
+	float volume,
+	glm::vec3 const &position,
+	float half_volume_radius = std::numeric_limits< float >::infinity(),
+	int32_t priority = 0,
+	std::shared_ptr< Bus > const &bus = nullptr //(null == straight to output)
 );
 
 //Call 'Sound::loop' to play a sample ~forever~.
@@ -113,14 +258,18 @@ std::shared_ptr< PlayingSample > play_3D(
 std::shared_ptr< PlayingSample > loop(
 	Sample const &sample,
 	float volume = 1.0f,
-	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
+	float pan = 0.0f, //-1.0f == hard left, 1.0f == hard right
+	int32_t priority = 0,
+	std::shared_ptr< Bus > const &bus = nullptr //(null == straight to output)
 );
 //The loop_3D version will loop a sample in '3D' mode (that is, panning determined by listener position):
 std::shared_ptr< PlayingSample > loop_3D(
 	Sample const &sample,
 	float volume,
 	glm::vec3 const &position,
-	float half_volume_radius = std::numeric_limits< float >::infinity()
+	float half_volume_radius = std::numeric_limits< float >::infinity(),
+	int32_t priority = 0,
+	std::shared_ptr< Bus > const &bus = nullptr //(null == straight to output)
 );
 
 //Listener controls the panning of "3D" samples (ones played using the "position" version of the play functions):
@@ -136,10 +285,71 @@ extern struct Listener listener;
 //"panic button" to shut off all currently playing sounds:
 void stop_all_samples();
 
+//voice limiting -- at most 'max_voices' samples (highest priority, then loudest) are mixed each period;
+// samples quieter than 'threshold' (linear gain) or over the limit become virtual:
+// they keep their place in time and are mixed again once audible.
+void set_max_voices(uint32_t max_voices, float threshold = 1.0e-3f);
+
+//how samples playing at rates other than 1.0 are resampled:
+enum ResampleQuality : uint8_t {
+	ResampleLinear, //linear interpolation between neighboring samples
+	ResampleSinc, //8-tap windowed sinc (cleaner highs; about 4x the cost)
+};
+void set_resample_quality(ResampleQuality quality);
+
+//multi-threaded mixing -- with 'threads' > 0, voices are mixed by a pool of worker threads
+// (rather than in the audio callback) one block ahead of output, adding one block of latency.
+// 0 (the default) mixes in the callback:
+void set_mix_threads(uint32_t threads);
+
+//device block size -- samples produced per audio callback -- is a power of two in [MinBlockSize, MaxBlockSize] (1024 by default).
+// smaller blocks mean lower latency but less time for each callback (see get_callback_stats for headroom).
+// ramps, panning, and voice selection update every MinBlockSize samples whatever the block size.
+// (may be called before or after init(); changing it re-opens the audio device)
+constexpr uint32_t const MinBlockSize = 128;
+constexpr uint32_t const MaxBlockSize = 2048;
+void set_block_size(uint32_t samples); //(rounded up to a power of two, and clamped)
+uint32_t get_block_size();
+
 //set global volume:
 void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
 extern Ramp< float > volume;
 
+//the output passes through a look-ahead peak limiter (adding about 1.5ms of latency),
+// so it never exceeds 'ceiling' (linear) even when many loud samples play at once:
+void set_limiter(bool enabled, float ceiling = 0.98f, float release = 0.1f);
+
+//output health, updated every callback and readable (without locking) from any thread:
+struct MixerStats {
+	float peak_level = 0.0f; //largest absolute output sample (before the limiter) since the last reset
+	float limiter_gain = 1.0f; //smallest limiter gain since the last reset (1.0 == never limited)
+	uint64_t clipped_samples = 0; //output samples over 1.0 before the limiter since the last reset (clipped if the limiter is off)
+	float callback_seconds = 0.0f; //duration of the most recent callback
+	uint32_t active_voices = 0; //samples mixed in the most recent callback
+	uint32_t playing_samples = 0; //samples playing, including virtual (unmixed) ones
+};
+//'reset' restarts the since-last-reset values (e.g., call once per frame to get per-frame values):
+MixerStats get_mixer_stats(bool reset = true);
+
+//audio callback timing, for judging how much headroom the mixer has (and so what block size a platform can use):
+struct CallbackStats {
+	static constexpr uint32_t const Buckets = 20;
+	//callbacks that took [2^b, 2^(b+1)) microseconds (bucket 0 also counts faster ones; the last bucket, slower ones):
+	uint64_t histogram[Buckets] = {};
+	uint64_t callbacks = 0;
+	double budget_seconds = 0.0; //audio produced per callback (a callback must finish in less than this)
+	double total_seconds = 0.0; //time spent in callbacks
+	double max_seconds = 0.0; //longest callback
+	uint64_t over_budget = 0; //callbacks that took longer than budget_seconds
+	//underruns -- callbacks that started more than 1.5x budget_seconds after the previous one,
+	// which means the device probably ran dry (a click or gap was heard):
+	uint64_t late = 0;
+	double max_interval_seconds = 0.0; //longest time between callback starts
+};
+//(read without locking; values gathered since the last reset):
+CallbackStats get_callback_stats();
+void reset_callback_stats();
+
 //the audio callback doesn't run between Sound::lock() and Sound::unlock()
 // the set_*/stop/play/... functions already use these helpers, so you shouldn't need
 // to call them unless your code is modifying values directly:
@@ -0,0 +1,136 @@
+#include "SoundEffects.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace Sound;
+
+//------------------ LowPass ------------------
+
+LowPass::LowPass(float cutoff_, float resonance_) : cutoff(cutoff_), resonance(resonance_) {
+}
+
+void LowPass::set_cutoff(float hz, float ramp) {
+	lock();
+	cutoff.set(hz, ramp);
+	unlock();
+}
+
+void LowPass::process(float *stereo, uint32_t frames) {
+	//coefficients are recomputed every Step frames, which is often enough for ramps to sound smooth:
+	constexpr uint32_t const Step = 64;
+	constexpr float const Pi = 3.14159265358979323846f;
+
+	for (uint32_t begin = 0; begin < frames; begin += Step) {
+		uint32_t end = std::min(frames, begin + Step);
+
+		//RBJ "audio EQ cookbook" low-pass:
+		float hz = std::max(10.0f, std::min(0.45f * AUDIO_RATE, cutoff.value));
+		float w0 = 2.0f * Pi * hz / float(AUDIO_RATE);
+		float alpha = std::sin(w0) / (2.0f * std::max(0.1f, resonance));
+		float cw = std::cos(w0);
+		float a0 = 1.0f + alpha;
+		float b0 = (1.0f - cw) * 0.5f / a0;
+		float b1 = (1.0f - cw) / a0;
+		float b2 = b0;
+		float a1 = -2.0f * cw / a0;
+		float a2 = (1.0f - alpha) / a0;
+
+		for (uint32_t c = 0; c < 2; ++c) {
+			float s1 = z1[c], s2 = z2[c];
+			for (uint32_t f = begin; f < end; ++f) {
+				float x = stereo[2*f+c];
+				float y = b0 * x + s1;
+				s1 = b1 * x - a1 * y + s2;
+				s2 = b2 * x - a2 * y;
+				stereo[2*f+c] = y;
+			}
+			z1[c] = s1;
+			z2[c] = s2;
+		}
+
+		cutoff.step(float(end - begin) / float(AUDIO_RATE));
+	}
+}
+
+//------------------ Reverb ------------------
+//(structure follows the public-domain "Freeverb")
+
+Reverb::Reverb(float room_size_, float damping_, float wet_) : room_size(room_size_), damping(damping_), wet(wet_) {
+	//delay lengths (in samples at 44.1kHz) from Freeverb, with the right channel slightly longer for stereo width:
+	static uint32_t const CombLengths[8] = {1116, 1188, 1277, 1356, 1422, 1491, 1557, 1617};
+	static uint32_t const AllpassLengths[4] = {556, 441, 341, 225};
+	constexpr uint32_t const Spread = 23;
+
+	auto scaled = [](uint32_t length) {
+		return std::max(1U, uint32_t(uint64_t(length) * AUDIO_RATE / 44100));
+	};
+	for (uint32_t c = 0; c < 2; ++c) {
+		for (uint32_t i = 0; i < 8; ++i) {
+			channels[c].combs[i].buffer.assign(scaled(CombLengths[i] + c * Spread), 0.0f);
+		}
+		for (uint32_t i = 0; i < 4; ++i) {
+			channels[c].allpasses[i].buffer.assign(scaled(AllpassLengths[i] + c * Spread), 0.0f);
+		}
+	}
+}
+
+void Reverb::process(float *stereo, uint32_t frames) {
+	constexpr float const InputGain = 0.015f;
+	constexpr float const WetScale = 3.0f;
+	float feedback = 0.7f + 0.28f * std::max(0.0f, std::min(1.0f, room_size));
+	float damp = 0.4f * std::max(0.0f, std::min(1.0f, damping));
+
+	for (uint32_t f = 0; f < frames; ++f) {
+		float input = (stereo[2*f+0] + stereo[2*f+1]) * InputGain;
+		for (uint32_t c = 0; c < 2; ++c) {
+			Channel &channel = channels[c];
+			float out = 0.0f;
+			for (uint32_t i = 0; i < 8; ++i) {
+				Delay &comb = channel.combs[i];
+				float delayed = comb.buffer[comb.at];
+				channel.comb_filter[i] = delayed * (1.0f - damp) + channel.comb_filter[i] * damp;
+				comb.buffer[comb.at] = input + channel.comb_filter[i] * feedback;
+				if (++comb.at == comb.buffer.size()) comb.at = 0;
+				out += delayed;
+			}
+			for (uint32_t i = 0; i < 4; ++i) {
+				Delay &allpass = channel.allpasses[i];
+				float delayed = allpass.buffer[allpass.at];
+				allpass.buffer[allpass.at] = out + delayed * 0.5f;
+				if (++allpass.at == allpass.buffer.size()) allpass.at = 0;
+				out = delayed - out;
+			}
+			stereo[2*f+c] += wet * WetScale * out;
+		}
+	}
+}
+
+//------------------ Compressor ------------------
+
+Compressor::Compressor(float threshold_, float ratio_, float attack_, float release_, float makeup_)
+	: threshold(threshold_), ratio(ratio_), attack(attack_), release(release_), makeup(makeup_) {
+}
+
+void Compressor::process(float *stereo, uint32_t frames) {
+	//one-pole detector coefficients:
+	float attack_coef = std::exp(-1.0f / (std::max(1.0e-5f, attack) * AUDIO_RATE));
+	float release_coef = std::exp(-1.0f / (std::max(1.0e-5f, release) * AUDIO_RATE));
+	float slope = 1.0f / std::max(1.0f, ratio) - 1.0f; //(exponent of gain reduction; -1 for a limiter)
+	float floor = std::max(1.0e-6f, threshold);
+
+	float sidechain_level = (sidechain ? sidechain->get_level() : 0.0f);
+
+	for (uint32_t f = 0; f < frames; ++f) {
+		float l = stereo[2*f+0];
+		float r = stereo[2*f+1];
+		float level = (sidechain ? sidechain_level : std::max(std::abs(l), std::abs(r)));
+
+		float coef = (level > envelope ? attack_coef : release_coef);
+		envelope = level + coef * (envelope - level);
+
+		gain = (envelope > floor ? std::pow(envelope / floor, slope) : 1.0f);
+		stereo[2*f+0] = l * gain * makeup;
+		stereo[2*f+1] = r * gain * makeup;
+	}
+}
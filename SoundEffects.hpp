@@ -0,0 +1,78 @@
+#pragma once
+
+/*
+ * Standard effects for Sound::Bus chains:
+ *  LowPass - resonant low-pass filter (e.g., muffling sounds heard from inside something)
+ *  Reverb - small-room to large-hall reverberation
+ *  Compressor - dynamic range compressor / limiter; with a side-chain bus it ducks its input
+ *   whenever the side-chain bus is loud (e.g., quieting ambience under stingers and dialog)
+ *
+ * Effects are run on the audio thread with the audio lock held, so change their
+ *  parameters between Sound::lock() and Sound::unlock() (or with the locking setters).
+ */
+
+#include "Sound.hpp"
+
+#include <array>
+
+namespace Sound {
+
+struct LowPass : Effect {
+	LowPass(float cutoff = 20000.0f, float resonance = 0.7071f);
+
+	//smoothly move the cutoff frequency (Hz):
+	void set_cutoff(float hz, float ramp = 1.0f / 60.0f);
+
+	virtual void process(float *stereo, uint32_t frames) override;
+
+	Ramp< float > cutoff;
+	float resonance; //filter Q (0.7071 == no peak at the cutoff)
+
+	//filter state (transposed direct form II), per channel:
+	float z1[2] = {0.0f, 0.0f};
+	float z2[2] = {0.0f, 0.0f};
+};
+
+struct Reverb : Effect {
+	Reverb(float room_size = 0.5f, float damping = 0.5f, float wet = 0.3f);
+
+	virtual void process(float *stereo, uint32_t frames) override;
+
+	float room_size; //[0,1]: longer tails as this grows
+	float damping; //[0,1]: darker tails as this grows
+	float wet; //level of reverberated signal added to the (unchanged) input
+
+	//a delay line (comb filters and allpasses are built from these):
+	struct Delay {
+		std::vector< float > buffer;
+		uint32_t at = 0;
+	};
+	//per channel: parallel feedback combs (with a one-pole low-pass in the loop) then serial allpasses:
+	struct Channel {
+		std::array< Delay, 8 > combs;
+		std::array< float, 8 > comb_filter = {};
+		std::array< Delay, 4 > allpasses;
+	};
+	Channel channels[2];
+};
+
+struct Compressor : Effect {
+	//threshold is a linear level; ratio of infinity makes a limiter:
+	Compressor(float threshold = 0.5f, float ratio = 4.0f, float attack = 0.005f, float release = 0.1f, float makeup = 1.0f);
+
+	virtual void process(float *stereo, uint32_t frames) override;
+
+	float threshold; //level above which gain is reduced
+	float ratio; //input:output ratio of level above threshold
+	float attack, release; //time (seconds) for the detector to follow rising / falling levels
+	float makeup; //gain applied after compression
+
+	//if set, the level of this bus (rather than the input) drives gain reduction:
+	// (n.b. if the side-chain bus is mixed after this one -- e.g., it is this bus's parent -- its level lags by a period)
+	std::shared_ptr< Bus > sidechain;
+
+	float envelope = 0.0f; //detector state
+	float gain = 1.0f; //last gain applied (before makeup), for meters
+};
+
+} //namespace Sound
@@ -0,0 +1,97 @@
+#include "UniformBlocks.hpp"
+
+#include "gl_errors.hpp"
+
+#include <cassert>
+#include <algorithm>
+#include <stdexcept>
+
+UniformBlocks &UniformBlocks::get() {
+	static UniformBlocks blocks;
+	return blocks;
+}
+
+UniformBlocks::UniformBlocks() {
+	glGenBuffers(1, &frame_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(Frame), nullptr, GL_STREAM_DRAW);
+
+	GLint alignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	alignment = std::max(alignment, 1);
+	object_stride = (GLsizeiptr(sizeof(Object)) + alignment - 1) / alignment * alignment;
+
+	//start with room for a few hundred drawables; grows as needed:
+	object_capacity = 256 * object_stride;
+	glGenBuffers(1, &object_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, object_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, object_capacity, nullptr, GL_STREAM_DRAW);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	GL_ERRORS();
+}
+
+UniformBlocks::~UniformBlocks() {
+	//n.b. the shared instance is destroyed after the context, so buffers are left for the context to clean up.
+}
+
+void UniformBlocks::set_frame(Frame const &frame) {
+	glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+	//re-specifying the whole buffer lets the driver hand back fresh storage rather than wait on last frame's draws:
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(Frame), &frame, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	glBindBufferBase(GL_UNIFORM_BUFFER, FrameBinding, frame_buffer);
+}
+
+void UniformBlocks::map_objects(uint32_t count) {
+	assert(mapped == nullptr && "should unmap_objects() before mapping again");
+	GLsizeiptr size = GLsizeiptr(std::max(count, 1U)) * object_stride;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, object_buffer);
+	if (size > object_capacity) {
+		//grow (which also orphans the old storage):
+		object_capacity = std::max(size, 2 * object_capacity);
+		glBufferData(GL_UNIFORM_BUFFER, object_capacity, nullptr, GL_STREAM_DRAW);
+		object_head = 0;
+	} else if (object_head + size > object_capacity) {
+		//wrap around, orphaning the storage that in-flight draws may still be reading:
+		glBufferData(GL_UNIFORM_BUFFER, object_capacity, nullptr, GL_STREAM_DRAW);
+		object_head = 0;
+	}
+
+	//ranges are never re-used without orphaning first, so no need for the driver to synchronize:
+	mapped_offset = object_head;
+	mapped = reinterpret_cast< char * >(glMapBufferRange(GL_UNIFORM_BUFFER, mapped_offset, size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+	if (!mapped) {
+		throw std::runtime_error("Failed to map uniform ring buffer.");
+	}
+	object_head += size;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformBlocks::unmap_objects() {
+	assert(mapped && "should map_objects() before unmapping");
+	glBindBuffer(GL_UNIFORM_BUFFER, object_buffer);
+	glUnmapBuffer(GL_UNIFORM_BUFFER);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	mapped = nullptr;
+}
+
+void UniformBlocks::bind_object(uint32_t index) const {
+	glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBinding, object_buffer, mapped_offset + index * object_stride, sizeof(Object));
+}
+
+void bind_uniform_blocks(GLuint program) {
+	GLuint frame_index = glGetUniformBlockIndex(program, "Frame");
+	if (frame_index != GL_INVALID_INDEX) {
+		glUniformBlockBinding(program, frame_index, UniformBlocks::FrameBinding);
+	}
+	GLuint object_index = glGetUniformBlockIndex(program, "Object");
+	if (object_index != GL_INVALID_INDEX) {
+		glUniformBlockBinding(program, object_index, UniformBlocks::ObjectBinding);
+	}
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+/*
+ * Uniform blocks shared by the programs that draw Scene::Drawables.
+ *
+ * "Frame" (bound at FrameBinding) holds per-frame data (camera, global lights, light cluster grid);
+ *  Scene::draw uploads it once per call. (Point and spot lights are in LightClusters.)
+ *
+ * "Object" (bound at ObjectBinding) holds per-drawable matrices;
+ *  Scene::draw writes all of them into a ring buffer with one map/unmap and then
+ *  selects each drawable's block with glBindBufferRange.
+ *
+ * Programs include the *_GLSL declarations below in their shader source and call
+ *  bind_uniform_blocks() once linked.
+ *
+ */
+
+#include "GL.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#define UNIFORM_BLOCKS_STR2(X) # X
+#define UNIFORM_BLOCKS_STR(X) UNIFORM_BLOCKS_STR2(X)
+
+//size of the (hemisphere and directional) light array in the "Frame" block:
+#define FRAME_MAX_LIGHTS 16
+
+//light types, as stored in Light::POSITION_TYPE.w:
+#define LIGHT_TYPE_POINT 0
+#define LIGHT_TYPE_HEMISPHERE 1
+#define LIGHT_TYPE_SPOT 2
+#define LIGHT_TYPE_DIRECTIONAL 3
+
+//GLSL declarations (layouts must match the structures in UniformBlocks below):
+#define FRAME_BLOCK_GLSL \
+	"struct Light {\n" \
+	"	vec4 POSITION_TYPE; //xyz: position (light space); w: type\n" \
+	"	vec4 DIRECTION_CUTOFF; //xyz: direction light points (light space); w: cos(spot half-angle)\n" \
+	"	vec4 ENERGY; //rgb: energy\n" \
+	"};\n" \
+	"layout(std140) uniform Frame {\n" \
+	"	mat4 WORLD_TO_CLIP;\n" \
+	"	int LIGHT_COUNT;\n" \
+	"	ivec4 CLUSTER_COUNT; //xyz: light clusters across, down, deep; w: local light count\n" \
+	"	vec4 CLUSTER_VIEWPORT; //viewport x, y, width, height (pixels)\n" \
+	"	vec4 CLUSTER_DEPTH; //x: nearest depth, y: slices / log(far/near), z: farthest depth\n" \
+	"	Light LIGHTS[" UNIFORM_BLOCKS_STR(FRAME_MAX_LIGHTS) "];\n" \
+	"};\n"
+
+#define OBJECT_BLOCK_GLSL \
+	"layout(std140) uniform Object {\n" \
+	"	mat4 OBJECT_TO_CLIP;\n" \
+	"	mat4x3 OBJECT_TO_LIGHT;\n" \
+	"	mat3 NORMAL_TO_LIGHT;\n" \
+	"};\n"
+
+struct UniformBlocks {
+	enum : GLuint {
+		FrameBinding = 0,
+		ObjectBinding = 1,
+	};
+
+	//std140 layout of the "Frame" block:
+	struct Light {
+		glm::vec4 POSITION_TYPE = glm::vec4(0.0f);
+		glm::vec4 DIRECTION_CUTOFF = glm::vec4(0.0f);
+		glm::vec4 ENERGY = glm::vec4(0.0f);
+	};
+	static_assert(sizeof(Light) == 3*16, "Light matches std140 layout.");
+	struct Frame {
+		glm::mat4 WORLD_TO_CLIP = glm::mat4(1.0f);
+		glm::ivec4 LIGHT_COUNT = glm::ivec4(0); //only .x is used; the rest pads to the next std140 vec4
+		glm::ivec4 CLUSTER_COUNT = glm::ivec4(0); //filled in by LightClusters::update
+		glm::vec4 CLUSTER_VIEWPORT = glm::vec4(0.0f);
+		glm::vec4 CLUSTER_DEPTH = glm::vec4(0.0f);
+		Light LIGHTS[FRAME_MAX_LIGHTS];
+	};
+	static_assert(sizeof(Frame) == 64 + 4 * 16 + FRAME_MAX_LIGHTS * sizeof(Light), "Frame matches std140 layout.");
+
+	//std140 layout of the "Object" block (n.b. std140 pads matrix columns to vec4):
+	struct Object {
+		glm::mat4 OBJECT_TO_CLIP;
+		glm::mat4 OBJECT_TO_LIGHT; //mat4x3 in GLSL
+		glm::mat3x4 NORMAL_TO_LIGHT; //mat3 in GLSL
+	};
+	static_assert(sizeof(Object) == 64 + 64 + 48, "Object matches std140 layout.");
+
+	//the shared instance (created on first use; needs a GL context):
+	static UniformBlocks &get();
+
+	//upload frame data and bind it to FrameBinding:
+	void set_frame(Frame const &frame);
+
+	//reserve (and map) ring space for 'count' Object blocks:
+	// write each with object(i), then call unmap_objects() before drawing
+	void map_objects(uint32_t count);
+	Object &object(uint32_t index) { return *reinterpret_cast< Object * >(mapped + index * object_stride); }
+	void unmap_objects();
+	//bind the index'th Object block from the last map_objects() to ObjectBinding:
+	void bind_object(uint32_t index) const;
+
+	//-- internals --
+	UniformBlocks();
+	~UniformBlocks();
+
+	GLuint frame_buffer = 0;
+
+	GLuint object_buffer = 0;
+	GLsizeiptr object_stride = 0; //sizeof(Object) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	GLsizeiptr object_capacity = 0; //size of object_buffer, in bytes
+	GLsizeiptr object_head = 0; //next free byte in object_buffer
+	GLsizeiptr mapped_offset = 0; //start of the range from the last map_objects()
+	char *mapped = nullptr;
+};
+
+//point a linked program's "Frame" and "Object" blocks (if it declares them) at the shared binding points:
+void bind_uniform_blocks(GLuint program);
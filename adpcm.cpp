@@ -0,0 +1,117 @@
+#include "adpcm.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+
+//standard IMA ADPCM tables:
+static int32_t const StepTable[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static int32_t const IndexTable[16] = {
+	-1, -1, -1, -1, 2, 4, 6, 8,
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+namespace {
+	struct State {
+		int32_t predictor = 0;
+		int32_t index = 0;
+
+		//advance the decoder state by one code (shared by encoder and decoder so they stay in step):
+		void apply(uint8_t code) {
+			int32_t step = StepTable[index];
+			int32_t diff = step >> 3;
+			if (code & 4) diff += step;
+			if (code & 2) diff += step >> 1;
+			if (code & 1) diff += step >> 2;
+			if (code & 8) predictor -= diff;
+			else predictor += diff;
+			predictor = std::max(-32768, std::min(32767, predictor));
+			index = std::max(0, std::min(88, index + IndexTable[code]));
+		}
+	};
+}
+
+static int32_t to_int16(float sample) {
+	return int32_t(std::round(std::max(-1.0f, std::min(1.0f, sample)) * 32767.0f));
+}
+
+void encode_adpcm(float const *samples, size_t count, std::vector< uint8_t > *blocks_) {
+	assert(samples || count == 0);
+	assert(blocks_);
+	auto &blocks = *blocks_;
+
+	size_t block_count = (count + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES;
+	blocks.assign(block_count * ADPCM_BLOCK_BYTES, 0);
+
+	State state;
+	//start with a step size near the first difference, rather than ramping up from the smallest step:
+	if (count >= 2) {
+		int32_t diff = std::abs(to_int16(samples[1]) - to_int16(samples[0]));
+		while (state.index < 88 && StepTable[state.index] < diff) ++state.index;
+	}
+
+	for (size_t b = 0; b < block_count; ++b) {
+		uint8_t *block = blocks.data() + b * ADPCM_BLOCK_BYTES;
+		size_t first = b * ADPCM_BLOCK_SAMPLES;
+
+		//header sample is stored exactly; step index carries over from the previous block:
+		state.predictor = to_int16(samples[first]);
+		block[0] = uint8_t(state.predictor & 0xff);
+		block[1] = uint8_t((state.predictor >> 8) & 0xff);
+		block[2] = uint8_t(state.index);
+		block[3] = 0;
+
+		for (uint32_t s = 1; s < ADPCM_BLOCK_SAMPLES; ++s) {
+			//(past the end, keep encoding silence so the final block is well-formed)
+			int32_t target = (first + s < count ? to_int16(samples[first + s]) : 0);
+
+			int32_t step = StepTable[state.index];
+			int32_t diff = target - state.predictor;
+			uint8_t code = 0;
+			if (diff < 0) {
+				code = 8;
+				diff = -diff;
+			}
+			if (diff >= step) { code |= 4; diff -= step; }
+			if (diff >= (step >> 1)) { code |= 2; diff -= (step >> 1); }
+			if (diff >= (step >> 2)) { code |= 1; }
+			state.apply(code);
+
+			uint8_t &byte = block[4 + (s - 1) / 2];
+			if ((s - 1) % 2 == 0) byte |= code;
+			else byte |= uint8_t(code << 4);
+		}
+	}
+}
+
+void decode_adpcm(uint8_t const *block, uint32_t begin, uint32_t count, float *out) {
+	assert(block);
+	assert(begin + count <= ADPCM_BLOCK_SAMPLES);
+	if (count == 0) return;
+
+	State state;
+	state.predictor = int16_t(uint16_t(block[0]) | (uint16_t(block[1]) << 8));
+	state.index = std::min< int32_t >(88, block[2]);
+
+	uint32_t end = begin + count;
+	constexpr float const Scale = 1.0f / 32767.0f;
+	if (begin == 0) *(out++) = state.predictor * Scale;
+	//codes before 'begin' still have to be run to recover the predictor:
+	for (uint32_t s = 1; s < end; ++s) {
+		uint8_t byte = block[4 + (s - 1) / 2];
+		state.apply(((s - 1) % 2 == 0) ? (byte & 0xf) : (byte >> 4));
+		if (s >= begin) *(out++) = state.predictor * Scale;
+	}
+}
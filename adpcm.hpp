@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+//IMA ADPCM (4 bits/sample) block compression for in-memory mono audio.
+//Each block stands alone, so playback can start decoding at any block:
+//  header: int16 first sample (little-endian), uint8 step index, uint8 zero
+//  then (ADPCM_BLOCK_SAMPLES - 1) four-bit codes, low nibble first.
+
+constexpr uint32_t const ADPCM_BLOCK_SAMPLES = 257; //samples per block (header sample + 256 codes)
+constexpr uint32_t const ADPCM_BLOCK_BYTES = 4 + (ADPCM_BLOCK_SAMPLES - 1) / 2;
+
+//compress 'count' floating-point samples (in [-1,1]) into whole blocks, replacing 'blocks':
+void encode_adpcm(float const *samples, size_t count, std::vector< uint8_t > *blocks);
+
+//decode samples [begin, begin + count) of the block starting at 'block' into 'out':
+// (begin + count <= ADPCM_BLOCK_SAMPLES)
+void decode_adpcm(uint8_t const *block, uint32_t begin, uint32_t count, float *out);
@@ -1,62 +1,336 @@
 #include "gl_compile_program.hpp"
 
+#include "data_path.hpp"
+#include "Load.hpp"
+#include "read_write_chunk.hpp"
+
+#include <SDL.h>
+
 #include <vector>
 #include <string>
 #include <stdexcept>
 #include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <list>
+
+//----- program binary cache -----
+//Linked programs are saved with GL_ARB_get_program_binary (core in 4.1) when the driver supports it,
+// and re-loaded on later runs instead of compiling from source.
+//Cache files are keyed by a hash of the shader sources and the driver vendor/renderer/version strings;
+// any mismatch or load failure just falls back to compiling from source (and re-writes the cache).
+
+//not part of GL.hpp's 3.3 core subset:
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH          0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS     0x87FE
+
+namespace {
+	struct ProgramBinaryAPI {
+		bool supported = false;
+		std::string driver; //vendor/renderer/version; part of the cache key
+		void (APIENTRY *GetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary) = nullptr;
+		void (APIENTRY *ProgramBinary)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length) = nullptr;
+		void (APIENTRY *ProgramParameteri)(GLuint program, GLenum pname, GLint value) = nullptr;
+	};
+
+	//looked up once, on first use (needs a current context):
+	ProgramBinaryAPI const &get_program_binary_api() {
+		static ProgramBinaryAPI api;
+		static bool initialized = false;
+		if (initialized) return api;
+		initialized = true;
+
+		auto gl_string = [](GLenum name) -> std::string {
+			GLubyte const *str = glGetString(name);
+			return str ? reinterpret_cast< char const * >(str) : "";
+		};
+		api.driver = gl_string(GL_VENDOR) + "\n" + gl_string(GL_RENDERER) + "\n" + gl_string(GL_VERSION);
+
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		if (!((major > 4 || (major == 4 && minor >= 1)) || SDL_GL_ExtensionSupported("GL_ARB_get_program_binary"))) {
+			return api;
+		}
+
+		//some drivers expose the entry points but no formats, which means binaries can't be saved:
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		if (formats <= 0) return api;
+
+		api.GetProgramBinary = (decltype(api.GetProgramBinary))SDL_GL_GetProcAddress("glGetProgramBinary");
+		api.ProgramBinary = (decltype(api.ProgramBinary))SDL_GL_GetProcAddress("glProgramBinary");
+		api.ProgramParameteri = (decltype(api.ProgramParameteri))SDL_GL_GetProcAddress("glProgramParameteri");
+		api.supported = (api.GetProgramBinary && api.ProgramBinary && api.ProgramParameteri);
+		return api;
+	}
+
+	//64-bit FNV-1a hash:
+	uint64_t hash_string(std::string const &str, uint64_t hash = 0xcbf29ce484222325ULL) {
+		for (char c : str) {
+			hash ^= uint8_t(c);
+			hash *= 0x100000001b3ULL;
+		}
+		return hash;
+	}
+
+	std::string cache_key(std::string const &driver, std::string const &vertex_shader_source, std::string const &fragment_shader_source) {
+		//sources are separated by '\0' so that moving text between them changes the key:
+		return driver + '\0' + vertex_shader_source + '\0' + fragment_shader_source;
+	}
+
+	std::string cache_filename(std::string const &key) {
+		char hex[17];
+		std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash_string(key));
+		return data_path(std::string("program-cache-") + hex + ".bin");
+	}
+
+	//Cache file format (see read_write_chunk.hpp):
+	// "key0" - the full cache key (guards against hash collisions)
+	// "fmt0" - one GLenum binary format
+	// "bin0" - program binary
+	bool load_program_binary(ProgramBinaryAPI const &api, std::string const &key, GLuint program) {
+		std::ifstream file(cache_filename(key), std::ios::binary);
+		if (!file) return false;
+
+		std::vector< char > stored_key;
+		std::vector< GLenum > format;
+		std::vector< char > binary;
+		try {
+			read_chunk(file, "key0", &stored_key);
+			read_chunk(file, "fmt0", &format);
+			read_chunk(file, "bin0", &binary);
+		} catch (std::runtime_error &) {
+			return false;
+		}
+		if (std::string(stored_key.begin(), stored_key.end()) != key) return false;
+		if (format.size() != 1 || binary.empty()) return false;
+
+		api.ProgramBinary(program, format[0], binary.data(), GLsizei(binary.size()));
+		GLint link_status = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+		if (link_status != GL_TRUE) {
+			//a format the driver no longer accepts raises GL_INVALID_ENUM; that's expected here, so don't leave it for GL_ERRORS():
+			while (glGetError() != GL_NO_ERROR) { }
+			return false;
+		}
+		return true;
+	}
+
+	void save_program_binary(ProgramBinaryAPI const &api, std::string const &key, GLuint program) {
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) return;
+
+		std::vector< char > binary(length);
+		std::vector< GLenum > format(1, 0);
+		GLsizei written = 0;
+		api.GetProgramBinary(program, length, &written, &format[0], binary.data());
+		if (written <= 0) return;
+		binary.resize(written);
+
+		std::string filename = cache_filename(key);
+		std::ofstream file(filename, std::ios::binary);
+		write_chunk("key0", std::vector< char >(key.begin(), key.end()), &file);
+		write_chunk("fmt0", format, &file);
+		write_chunk("bin0", binary, &file);
+		if (!file) {
+			std::cerr << "WARNING: failed to write program cache '" << filename << "'." << std::endl;
+		}
+	}
+}
+
+//----- parallel compilation -----
+//With GL_KHR_parallel_shader_compile (or the ARB version), the driver compiles and links on background threads
+// as long as nothing asks for the result; GL_COMPLETION_STATUS lets us check for results without blocking.
+
+#define GL_COMPLETION_STATUS              0x91B1
+
+namespace {
+	struct ParallelCompileAPI {
+		bool supported = false;
+		void (APIENTRY *MaxShaderCompilerThreads)(GLuint count) = nullptr;
+	};
+
+	ParallelCompileAPI const &get_parallel_compile_api() {
+		static ParallelCompileAPI api;
+		static bool initialized = false;
+		if (initialized) return api;
+		initialized = true;
+
+		if (SDL_GL_ExtensionSupported("GL_KHR_parallel_shader_compile")) {
+			api.MaxShaderCompilerThreads = (decltype(api.MaxShaderCompilerThreads))SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsKHR");
+		} else if (SDL_GL_ExtensionSupported("GL_ARB_parallel_shader_compile")) {
+			api.MaxShaderCompilerThreads = (decltype(api.MaxShaderCompilerThreads))SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsARB");
+		}
+		if (api.MaxShaderCompilerThreads) {
+			api.MaxShaderCompilerThreads(0xffffffff); //"as many threads as the implementation likes"
+			api.supported = true;
+		}
+		return api;
+	}
+
+	//a program whose compile/link has been issued but whose status hasn't been checked:
+	struct PendingProgram {
+		GLuint program = 0;
+		GLuint vertex_shader = 0; //kept around (until checked) for their info logs
+		GLuint fragment_shader = 0;
+		bool from_cache = false; //program was loaded (and checked) from the binary cache
+		std::string key; //binary cache key (empty if cache not supported)
+		std::function< void() > on_linked;
+	};
+
+	std::list< PendingProgram > &get_pending_programs() {
+		static std::list< PendingProgram > pending;
+		return pending;
+	}
+}
 
-static GLuint gl_compile_shader(GLenum type, std::string const &source) {
+//----- compiling from source -----
+
+static void print_shader_log(GLuint shader) {
+	GLint info_log_length = 0;
+	glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &info_log_length);
+	std::vector< GLchar > info_log(info_log_length + 1, 0);
+	GLsizei length = 0;
+	glGetShaderInfoLog(shader, GLint(info_log.size()), &length, &info_log[0]);
+	std::cerr << "Info log: " << std::string(info_log.begin(), info_log.begin() + length);
+}
+
+static GLuint gl_submit_shader(GLenum type, std::string const &source) {
 	GLuint shader = glCreateShader(type);
 	GLchar const *str = source.c_str();
 	GLint length = GLint(source.size());
 	glShaderSource(shader, 1, &str, &length);
 	glCompileShader(shader);
-	GLint compile_status = GL_FALSE;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_status);
-	if (compile_status != GL_TRUE) {
-		std::cerr << "Failed to compile shader." << std::endl;
-		GLint info_log_length = 0;
-		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &info_log_length);
-		std::vector< GLchar > info_log(info_log_length, 0);
-		GLsizei length = 0;
-		glGetShaderInfoLog(shader, GLint(info_log.size()), &length, &info_log[0]);
-		std::cerr << "Info log: " << std::string(info_log.begin(), info_log.begin() + length);
-		glDeleteShader(shader);
-		throw std::runtime_error("Failed to compile shader.");
-	}
+	//n.b. compile status isn't checked here so the driver can keep working; see finish_program()
 	return shader;
 }
 
-GLuint gl_compile_program(
+//issue all the work to build a program, without asking for any results that would make the driver wait:
+static PendingProgram submit_program(
 	std::string const &vertex_shader_source,
 	std::string const &fragment_shader_source
 	) {
+	PendingProgram ret;
+
+	ProgramBinaryAPI const &api = get_program_binary_api();
+	if (api.supported) {
+		ret.key = cache_key(api.driver, vertex_shader_source, fragment_shader_source);
 
-	GLuint vertex_shader = gl_compile_shader(GL_VERTEX_SHADER, vertex_shader_source);
-	GLuint fragment_shader = gl_compile_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
+		//try the cached binary first:
+		ret.program = glCreateProgram();
+		if (load_program_binary(api, ret.key, ret.program)) {
+			ret.from_cache = true;
+			return ret;
+		}
+		glDeleteProgram(ret.program);
+		//(otherwise, fall through to compiling from source)
+	}
 
-	GLuint program = glCreateProgram();
-	glAttachShader(program, vertex_shader);
-	glAttachShader(program, fragment_shader);
+	ret.vertex_shader = gl_submit_shader(GL_VERTEX_SHADER, vertex_shader_source);
+	ret.fragment_shader = gl_submit_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
 
-	//shaders are reference counted so this makes sure they are freed after program is deleted:
-	glDeleteShader(vertex_shader);
-	glDeleteShader(fragment_shader);
+	ret.program = glCreateProgram();
+	glAttachShader(ret.program, ret.vertex_shader);
+	glAttachShader(ret.program, ret.fragment_shader);
+
+	//ask the driver to keep a retrievable binary around for the cache:
+	if (api.supported) {
+		api.ProgramParameteri(ret.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	glLinkProgram(ret.program);
+
+	return ret;
+}
+
+//wait for a submitted program and throw errors if compiling or linking failed:
+static void finish_program(PendingProgram &pending) {
+	if (pending.from_cache) return;
 
-	//link the shader program and throw errors if linking fails:
-	glLinkProgram(program);
 	GLint link_status = GL_FALSE;
-	glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+	glGetProgramiv(pending.program, GL_LINK_STATUS, &link_status);
 	if (link_status != GL_TRUE) {
+		//report which stage failed:
+		for (GLuint shader : {pending.vertex_shader, pending.fragment_shader}) {
+			GLint compile_status = GL_FALSE;
+			glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_status);
+			if (compile_status != GL_TRUE) {
+				std::cerr << "Failed to compile shader." << std::endl;
+				print_shader_log(shader);
+			}
+		}
 		std::cerr << "Failed to link shader program." << std::endl;
 		GLint info_log_length = 0;
-		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &info_log_length);
-		std::vector< GLchar > info_log(info_log_length, 0);
+		glGetProgramiv(pending.program, GL_INFO_LOG_LENGTH, &info_log_length);
+		std::vector< GLchar > info_log(info_log_length + 1, 0);
 		GLsizei length = 0;
-		glGetProgramInfoLog(program, GLint(info_log.size()), &length, &info_log[0]);
+		glGetProgramInfoLog(pending.program, GLint(info_log.size()), &length, &info_log[0]);
 		std::cerr << "Info log: " << std::string(info_log.begin(), info_log.begin() + length);
+		glDeleteShader(pending.vertex_shader);
+		glDeleteShader(pending.fragment_shader);
+		glDeleteProgram(pending.program);
 		throw std::runtime_error("failed to link program");
 	}
 
-	return program;
+	//shaders are reference counted so this makes sure they are freed after program is deleted:
+	glDeleteShader(pending.vertex_shader);
+	glDeleteShader(pending.fragment_shader);
+	pending.vertex_shader = pending.fragment_shader = 0;
+
+	if (!pending.key.empty()) {
+		save_program_binary(get_program_binary_api(), pending.key, pending.program);
+	}
+}
+
+GLuint gl_compile_program(
+	std::string const &vertex_shader_source,
+	std::string const &fragment_shader_source
+	) {
+	PendingProgram pending = submit_program(vertex_shader_source, fragment_shader_source);
+	finish_program(pending);
+	return pending.program;
+}
+
+GLuint gl_submit_program(
+	std::string const &vertex_shader_source,
+	std::string const &fragment_shader_source,
+	std::function< void() > const &on_linked
+	) {
+	get_parallel_compile_api(); //(enables background compiler threads on first use)
+
+	auto &pending = get_pending_programs();
+	if (pending.empty()) {
+		//check this (and any other programs submitted meanwhile) once the rest of the early loaders have run:
+		add_load_function(LoadTagEarly, gl_finish_programs);
+	}
+	pending.emplace_back(submit_program(vertex_shader_source, fragment_shader_source));
+	pending.back().on_linked = on_linked;
+	return pending.back().program;
+}
+
+void gl_finish_programs() {
+	ParallelCompileAPI const &parallel = get_parallel_compile_api();
+	auto &pending = get_pending_programs();
+	while (!pending.empty()) {
+		//take programs in the order the driver finishes them (if it can say) or else the order they were submitted:
+		auto ready = pending.begin();
+		if (parallel.supported) {
+			for (auto p = pending.begin(); p != pending.end(); ++p) {
+				GLint complete = GL_FALSE;
+				glGetProgramiv(p->program, GL_COMPLETION_STATUS, &complete);
+				if (complete == GL_TRUE) {
+					ready = p;
+					break;
+				}
+			}
+		}
+
+		PendingProgram program = *ready;
+		pending.erase(ready);
+		finish_program(program);
+		if (program.on_linked) program.on_linked();
+	}
 }
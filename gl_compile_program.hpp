@@ -3,9 +3,26 @@
 #include "GL.hpp"
 
 #include <string>
+#include <functional>
 
 //compiles+links an OpenGL shader program from source.
 // throws on compilation error.
+// when the driver supports program binaries, linked programs are cached next to the executable
+// (data_path("program-cache-*.bin")) and re-used on later runs with the same sources and driver.
 GLuint gl_compile_program(
 	std::string const &vertex_shader_source,
 	std::string const &fragment_shader_source);
+
+//starts compiling+linking a shader program without waiting for the driver to finish:
+// (use this from LoadTagEarly loading functions so that all programs build concurrently)
+// the program isn't usable until 'on_linked' is called, which looks up attribute/uniform locations and so on.
+// status checks are deferred to gl_finish_programs(), which is queued to run after the other LoadTagEarly functions.
+// uses GL_KHR_parallel_shader_compile, when available, so the driver can compile on background threads.
+GLuint gl_submit_program(
+	std::string const &vertex_shader_source,
+	std::string const &fragment_shader_source,
+	std::function< void() > const &on_linked);
+
+//checks all submitted programs (throws on compilation error) and calls their 'on_linked' functions:
+// (normally called automatically; see above)
+void gl_finish_programs();
@@ -2,51 +2,169 @@
 
 #include <opusfile.h>
 
+#include <algorithm>
 #include <cassert>
 #include <memory>
 #include <cmath>
 #include <stdexcept>
 #include <iostream>
+#include <thread>
+#include <exception>
 
-void load_opus(std::string const &filename, std::vector< float > *data_) {
-	assert(data_);
-	auto &data = *data_;
-	data.clear();
-
-	std::cout << "loading '" << filename << "'..."; std::cout.flush();
+typedef std::unique_ptr< OggOpusFile, decltype(&op_free) > OpusFilePtr;
 
-	//will hold opusfile * int a std::unique_ptr so that it will automatically be deleted:
+//open 'filename' as a OggOpusFile held in a std::unique_ptr, so that it will automatically be deleted:
+static OpusFilePtr open_opus(std::string const &filename) {
 	int err = 0;
-	std::unique_ptr< OggOpusFile, decltype(&op_free) > op(
+	OpusFilePtr op(
 		op_open_file(filename.c_str(), &err), //pointer to hold
 		op_free //deletion function
 	);
 	if (err != 0) {
 		throw std::runtime_error("opusfile error " + std::to_string(err) + " opening \"" + filename + "\".");
 	}
+	return op;
+}
+
+constexpr size_t const MaxFrame = 5760; //samples in 120ms, the longest an opus packet can decode to
+
+//decode (and mix to mono) up to 'count' samples from the current position into 'dst'; returns samples decoded (fewer at end of stream):
+static size_t decode_mono(OggOpusFile *op, float *dst, size_t count, std::string const &filename) {
+	std::vector< float > stereo; //for links with more than one channel (and for the last partial packet)
+	size_t at = 0;
+	while (at < count) {
+		size_t want = std::min< size_t >(count - at, 1 << 20);
+		float *out = dst + at;
+
+		int ret;
+		if (want >= MaxFrame && op_channel_count(op, -1) == 1) {
+			//mono link: decode directly into place:
+			int li = -1;
+			ret = op_read_float(op, out, int(want), &li);
+			int channels = (ret > 0 ? op_channel_count(op, li) : 1);
+			if (channels > 1) {
+				//(the read crossed into a link with more channels, so 'ret' interleaved frames were written; downmix in place)
+				for (int i = 0; i < ret; ++i) {
+					float sum = 0.0f;
+					for (int c = 0; c < channels; ++c) {
+						sum += out[i * channels + c];
+					}
+					out[i] = sum / float(channels);
+				}
+			}
+		} else {
+			//multi-channel link: let opusfile mix down to stereo, then average:
+			stereo.resize(2 * std::min(want, MaxFrame));
+			ret = op_read_float_stereo(op, stereo.data(), int(stereo.size()));
+			float const *src = stereo.data();
+			for (int i = 0; i < ret; ++i) {
+				out[i] = (src[2*i] + src[2*i+1]) * 0.5f;
+			}
+		}
+
+		if (ret < 0) {
+			throw std::runtime_error("opusfile read error " + std::to_string(ret) + " reading \"" + filename + "\".");
+		}
+		if (ret == 0) break;
+		at += size_t(ret);
+	}
+	return at;
+}
+
+//decode samples [begin, end) of 'filename' into dst[0 .. end-begin) using a handle of its own (so segments can run in parallel):
+static void decode_segment(std::string const &filename, ogg_int64_t begin, ogg_int64_t end, float *dst) {
+	OpusFilePtr op = open_opus(filename);
+
+	if (begin > 0) {
+		//op_pcm_seek lands on exactly the right sample, but the decoder only converges on the state a sequential
+		// decode would have after some pre-roll; opusfile pre-rolls the minimum, so start further back and discard:
+		constexpr ogg_int64_t const Preroll = 3840; //80ms
+		ogg_int64_t start = std::max< ogg_int64_t >(0, begin - Preroll);
+		int ret = op_pcm_seek(op.get(), start);
+		if (ret != 0) {
+			throw std::runtime_error("opusfile seek error " + std::to_string(ret) + " in \"" + filename + "\".");
+		}
+		std::vector< float > discard(size_t(begin - start));
+		if (decode_mono(op.get(), discard.data(), discard.size(), filename) != discard.size()) {
+			throw std::runtime_error("\"" + filename + "\" ended before its reported length.");
+		}
+	}
+
+	size_t count = size_t(end - begin);
+	if (decode_mono(op.get(), dst, count, filename) != count) {
+		throw std::runtime_error("\"" + filename + "\" ended before its reported length.");
+	}
+}
+
+void load_opus(std::string const &filename, std::vector< float > *data_) {
+	assert(data_);
+	auto &data = *data_;
+	data.clear();
+
+	std::cout << "loading '" << filename << "'..."; std::cout.flush();
+
+	OpusFilePtr op = open_opus(filename);
 
 	//get length in samples:
 	ogg_int64_t length = op_pcm_total(op.get(), -1);
-	if (length >= 0) {
-		data.reserve(length);
-	} else {
+	if (length < 0) {
 		std::cerr << "WARNING: cannot estimate length of '" << filename << "', loading may be slow." << std::endl;
-		length = 0;
-		data.reserve(2*48000);
-	}
 
-	std::vector< float > pcm(2*48000*2, 0.0f); //seems like reads are generally 960 samples so this is definitely overkill
-	for (;;) {
-		int ret = op_read_float_stereo(op.get(), pcm.data(), int(pcm.size()));
-		if (ret >= 0) {
-			//positive return values are the number of samples read per channel; copy into data:
-			data.reserve(data.size() + ret);
-			for (uint32_t i = 0; i < uint32_t(ret); ++i) {
-				data.emplace_back((pcm[2*i] + pcm[2*i+1]) * 0.5f); //downmix to mono by averaging
+		//decode straight into 'data', growing it as needed:
+		size_t at = 0;
+		data.resize(2*48000);
+		for (;;) {
+			if (data.size() - at < MaxFrame) {
+				data.resize(std::max(data.size() * 2, at + MaxFrame));
 			}
-			if (ret == 0) break;
+			size_t got = decode_mono(op.get(), data.data() + at, data.size() - at, filename);
+			at += got;
+			if (at < data.size()) break; //(stopped short, so at end of stream)
+		}
+		data.resize(at);
+
+	} else {
+		data.resize(size_t(length));
+
+		//long files are split into segments that are decoded in parallel, each with its own handle:
+		constexpr ogg_int64_t const MinSegment = 10 * 48000;
+		uint32_t segments = std::max(1U, std::min(std::thread::hardware_concurrency(), uint32_t(std::min< ogg_int64_t >(length / MinSegment, 64))));
+
+		if (segments == 1) {
+			data.resize(decode_mono(op.get(), data.data(), data.size(), filename));
 		} else {
-			throw std::runtime_error("opusfile read error " + std::to_string(ret) + " reading \"" + filename + "\".");
+			op.reset(); //(every segment opens its own handle)
+
+			std::vector< std::exception_ptr > errors(segments);
+			std::vector< std::thread > threads;
+			threads.reserve(segments - 1); //(so starting a thread is the only thing below that can throw)
+			for (uint32_t s = 0; s < segments; ++s) {
+				ogg_int64_t begin = length * s / segments;
+				ogg_int64_t end = length * (s + 1) / segments;
+				auto decode = [&filename, &errors, &data, s, begin, end]() {
+					try {
+						decode_segment(filename, begin, end, data.data() + begin);
+					} catch (...) {
+						errors[s] = std::current_exception();
+					}
+				};
+				if (s + 1 < segments) {
+					try {
+						threads.emplace_back(decode);
+					} catch (...) {
+						//couldn't start a thread (e.g., std::system_error); decode this segment here instead:
+						decode();
+					}
+				} else {
+					decode(); //(this thread decodes the last segment)
+				}
+			}
+			for (auto &thread : threads) {
+				thread.join();
+			}
+			for (auto const &error : errors) {
+				if (error) std::rethrow_exception(error);
+			}
 		}
 	}
 
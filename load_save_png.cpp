@@ -5,23 +5,49 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
+#include <cstring>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 
 #define LOG_ERROR( X ) std::cerr << X << std::endl
 
 using std::vector;
 
-bool load_png(std::istream &from, unsigned int *width, unsigned int *height, vector< glm::u8vec4 > *data, OriginLocation origin);
-void save_png(std::ostream &to, unsigned int width, unsigned int height, glm::u8vec4 const *data, OriginLocation origin);
+//decoding reads from a span of memory rather than through an istream:
+struct PNGMemoryReader {
+	png_const_bytep at = nullptr;
+	png_const_bytep end = nullptr;
+};
 
-void load_png(std::string filename, glm::uvec2 *size, std::vector< glm::u8vec4 > *data, OriginLocation origin) {
-	assert(size);
+//'get_pixels' is called once the IHDR has been read and should return storage for w*h pixels (or nullptr to abort):
+template< typename GetPixels >
+static bool load_png(PNGMemoryReader *from, unsigned int *width, unsigned int *height, GetPixels const &get_pixels, OriginLocation origin);
+void save_png(std::ostream &to, unsigned int width, unsigned int height, glm::u8vec4 const *data, OriginLocation origin);
 
-	std::ifstream file(filename.c_str(), std::ios::binary);
+//read a whole file into memory:
+static void read_file(std::string const &filename, vector< char > *data) {
+	std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
 	if (!file) {
 		throw std::runtime_error("Failed to open PNG image file '" + filename + "'.");
 	}
-	if (!load_png(file, &size->x, &size->y, data, origin)) {
+	std::streamsize length = file.tellg();
+	file.seekg(0, std::ios::beg);
+	data->resize(size_t(length));
+	if (length > 0 && !file.read(data->data(), length)) {
+		throw std::runtime_error("Failed to read PNG image file '" + filename + "'.");
+	}
+}
+
+void load_png(std::string filename, glm::uvec2 *size, std::vector< glm::u8vec4 > *data, OriginLocation origin) {
+	assert(size);
+
+	vector< char > file;
+	read_file(filename, &file);
+	try {
+		load_png(file.data(), file.size(), size, data, origin);
+	} catch (std::runtime_error &) {
 		throw std::runtime_error("Failed to read PNG image from '" + filename + "'.");
 	}
 }
@@ -31,13 +57,112 @@ void save_png(std::string filename, glm::uvec2 size, glm::u8vec4 const *data, Or
 	save_png(file, size.x, size.y, data, origin);
 }
 
+void load_png(void const *png_data, size_t png_size, glm::uvec2 *size, std::vector< glm::u8vec4 > *data, OriginLocation origin) {
+	assert(size);
+	assert(data);
+
+	PNGMemoryReader from;
+	from.at = reinterpret_cast< png_const_bytep >(png_data);
+	from.end = from.at + png_size;
+
+	bool ok = load_png(&from, &size->x, &size->y, [data](unsigned int w, unsigned int h) -> glm::u8vec4 * {
+		data->resize(size_t(w) * size_t(h)); //n.b. resize() keeps existing capacity
+		return data->data();
+	}, origin);
+	if (!ok) {
+		data->clear();
+		throw std::runtime_error("Failed to read PNG image from memory.");
+	}
+}
+
+glm::uvec2 png_image_size(void const *png_data, size_t png_size) {
+	//signature (8 bytes), then IHDR chunk: length (4), type (4), width (4, big-endian), height (4, big-endian):
+	png_const_bytep bytes = reinterpret_cast< png_const_bytep >(png_data);
+	if (png_size < 8 + 4 + 4 + 4 + 4
+	 || png_sig_cmp(bytes, 0, 8) != 0
+	 || std::memcmp(bytes + 12, "IHDR", 4) != 0) {
+		throw std::runtime_error("Data does not start with a PNG signature and IHDR chunk.");
+	}
+	auto read_u32 = [](png_const_bytep b) -> uint32_t {
+		return (uint32_t(b[0]) << 24) | (uint32_t(b[1]) << 16) | (uint32_t(b[2]) << 8) | uint32_t(b[3]);
+	};
+	return glm::uvec2(read_u32(bytes + 16), read_u32(bytes + 20));
+}
+
+void load_png(void const *png_data, size_t png_size, glm::uvec2 size, glm::u8vec4 *pixels, OriginLocation origin) {
+	assert(pixels);
+
+	PNGMemoryReader from;
+	from.at = reinterpret_cast< png_const_bytep >(png_data);
+	from.end = from.at + png_size;
+
+	bool ok = load_png(&from, nullptr, nullptr, [&size,pixels](unsigned int w, unsigned int h) -> glm::u8vec4 * {
+		if (w != size.x || h != size.y) {
+			LOG_ERROR("  image size doesn't match the size of the supplied buffer.");
+			return nullptr;
+		}
+		return pixels;
+	}, origin);
+	if (!ok) {
+		throw std::runtime_error("Failed to read PNG image from memory.");
+	}
+}
+
+void load_pngs(std::vector< std::string > const &filenames, std::vector< glm::uvec2 > *sizes_, std::vector< std::vector< glm::u8vec4 > > *data_, OriginLocation origin, uint32_t max_threads) {
+	assert(sizes_);
+	assert(data_);
+	auto &sizes = *sizes_;
+	auto &data = *data_;
+
+	sizes.assign(filenames.size(), glm::uvec2(0));
+	data.resize(filenames.size());
+
+	if (max_threads == 0) max_threads = std::max(1U, std::thread::hardware_concurrency());
+	uint32_t thread_count = uint32_t(std::min< size_t >(max_threads, filenames.size()));
+
+	//workers pull the next file index from a shared counter, and each keeps its own file buffer:
+	std::atomic< size_t > next(0);
+	vector< std::string > errors(filenames.size());
+	auto work = [&]() {
+		vector< char > file;
+		for (size_t i = next++; i < filenames.size(); i = next++) {
+			try {
+				read_file(filenames[i], &file);
+				load_png(file.data(), file.size(), &sizes[i], &data[i], origin);
+			} catch (std::exception &e) {
+				errors[i] = "'" + filenames[i] + "': " + e.what();
+			}
+		}
+	};
+
+	vector< std::thread > threads;
+	threads.reserve(thread_count);
+	for (uint32_t t = 1; t < thread_count; ++t) {
+		threads.emplace_back(work);
+	}
+	work(); //calling thread helps too
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	std::string message;
+	for (auto const &error : errors) {
+		if (!error.empty()) message += "\n  " + error;
+	}
+	if (!message.empty()) {
+		throw std::runtime_error("Failed to load PNG images:" + message);
+	}
+}
+
 
 static void user_read_data(png_structp png_ptr, png_bytep data, png_size_t length) {
-	std::istream *from = reinterpret_cast< std::istream * >(png_get_io_ptr(png_ptr));
+	PNGMemoryReader *from = reinterpret_cast< PNGMemoryReader * >(png_get_io_ptr(png_ptr));
 	assert(from);
-	if (!from->read(reinterpret_cast< char * >(data), length)) {
+	if (size_t(from->end - from->at) < length) {
 		png_error(png_ptr, "Error reading.");
 	}
+	std::memcpy(data, from->at, length);
+	from->at += length;
 }
 
 static void user_write_data(png_structp png_ptr, png_bytep data, png_size_t length) {
@@ -57,35 +182,37 @@ static void user_flush_data(png_structp png_ptr) {
 }
 
 
-bool load_png(std::istream &from, unsigned int *width, unsigned int *height, vector< glm::u8vec4 > *data, OriginLocation origin) {
-	assert(data);
+template< typename GetPixels >
+static bool load_png(PNGMemoryReader *from, unsigned int *width, unsigned int *height, GetPixels const &get_pixels, OriginLocation origin) {
+	assert(from);
 	uint32_t local_width, local_height;
 	if (width == nullptr) width = &local_width;
 	if (height == nullptr) height = &local_height;
 	*width = *height = 0;
-	data->clear();
+
+	//row pointers are kept per-thread so repeated loads don't allocate:
+	static thread_local vector< png_bytep > row_pointers;
+
 	//..... load file ......
 	//Load a png file, as per the libpng docs:
 	png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, (png_voidp)NULL, (png_error_ptr)NULL, (png_error_ptr)NULL);
 
-	png_set_read_fn(png, &from, user_read_data);
-
 	if (!png) {
 		LOG_ERROR("  cannot alloc read struct.");
 		return false;
 	}
+
+	png_set_read_fn(png, from, user_read_data);
+
 	png_infop info = png_create_info_struct(png);
 	if (!info) {
 		LOG_ERROR("  cannot alloc info struct.");
 		png_destroy_read_struct(&png, (png_infopp)NULL, (png_infopp)NULL);
 		return false;
 	}
-	png_bytep *row_pointers = NULL;
 	if (setjmp(png_jmpbuf(png))) {
 		LOG_ERROR("  png interal error.");
 		png_destroy_read_struct(&png, &info, (png_infopp)NULL);
-		if (row_pointers != NULL) delete[] row_pointers;
-		data->clear();
 		return false;
 	}
 	//not needed with custom read/write functions: png_init_io(png, NULL);
@@ -109,18 +236,23 @@ bool load_png(std::istream &from, unsigned int *width, unsigned int *height, vec
 	//Make sure it's the format we think it is...
 	assert(rowbytes == w*sizeof(uint32_t));
 
-	data->resize(w*h);
-	row_pointers = new png_bytep[h];
+	glm::u8vec4 *pixels = get_pixels(w, h);
+	if (!pixels) {
+		png_destroy_read_struct(&png, &info, NULL);
+		return false;
+	}
+
+	//flipping is free -- libpng just writes each row through a flipped pointer:
+	row_pointers.resize(h);
 	for (unsigned int r = 0; r < h; ++r) {
 		if (origin == LowerLeftOrigin) {
-			row_pointers[h-1-r] = (png_bytep)(&(*data)[r*w]);
+			row_pointers[h-1-r] = (png_bytep)(pixels + size_t(r)*w);
 		} else {
-			row_pointers[r] = (png_bytep)(&(*data)[r*w]);
+			row_pointers[r] = (png_bytep)(pixels + size_t(r)*w);
 		}
 	}
-	png_read_image(png, row_pointers);
+	png_read_image(png, row_pointers.data());
 	png_destroy_read_struct(&png, &info, NULL);
-	delete[] row_pointers;
 
 	*width = w;
 	*height = h;
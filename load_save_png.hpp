@@ -17,4 +17,21 @@ enum OriginLocation {
 
 //NOTE: load_png will throw on error
 void load_png(std::string filename, glm::uvec2 *size, std::vector< glm::u8vec4 > *data, OriginLocation origin);
+
+//load from PNG data already in memory (e.g., read or memory-mapped by the caller):
+// 'data' is resized to fit the image; its existing capacity is reused, so decoding
+// many images through the same vector avoids reallocating per image.
+void load_png(void const *png_data, size_t png_size, glm::uvec2 *size, std::vector< glm::u8vec4 > *data, OriginLocation origin);
+
+//read the image size from the IHDR chunk of in-memory PNG data without decoding it:
+glm::uvec2 png_image_size(void const *png_data, size_t png_size);
+
+//decode straight into a caller-provided buffer, which must hold at least size.x * size.y pixels,
+// where size is the one returned by png_image_size:
+void load_png(void const *png_data, size_t png_size, glm::uvec2 size, glm::u8vec4 *pixels, OriginLocation origin);
+
+//load many files concurrently on a small pool of worker threads:
+// (sizes and data are resized to match filenames; max_threads == 0 means "one per core")
+// (throws, after all workers are done, if any file failed to load)
+void load_pngs(std::vector< std::string > const &filenames, std::vector< glm::uvec2 > *sizes, std::vector< std::vector< glm::u8vec4 > > *data, OriginLocation origin, uint32_t max_threads = 0);
 void save_png(std::string filename, glm::uvec2 size, glm::u8vec4 const *data, OriginLocation origin);
@@ -3,13 +3,114 @@
 #include <SDL.h>
 
 #include <iostream>
+#include <fstream>
 #include <cassert>
+#include <cstring>
 #include <algorithm>
 
 constexpr uint32_t AUDIO_RATE = 48000;
 
-void load_wav(std::string const &filename, std::vector< float > *data_) {
-	assert(data_);
+static uint16_t le16(char const *at) {
+	return uint16_t(uint8_t(at[0]) | (uint8_t(at[1]) << 8));
+}
+static uint32_t le32(char const *at) {
+	return uint32_t(le16(at)) | (uint32_t(le16(at + 2)) << 16);
+}
+
+//read 48kHz 16-bit integer or 32-bit float, mono or stereo WAV files without going through SDL;
+// returns false (having changed nothing) for anything else, which is left to SDL_LoadWAV:
+static bool load_wav_direct(std::string const &filename, std::vector< float > *data_) {
+	auto &data = *data_;
+
+	//(sample data is read straight into memory, so this only works on little-endian machines -- i.e., all the usual ones)
+	uint16_t one = 1;
+	if (*reinterpret_cast< uint8_t const * >(&one) != 1) return false;
+
+	std::ifstream file(filename, std::ios::binary);
+	char riff[12];
+	if (!file.read(riff, 12) || std::memcmp(riff, "RIFF", 4) != 0 || std::memcmp(riff + 8, "WAVE", 4) != 0) return false;
+
+	//find the format and data chunks:
+	enum : uint16_t { FormatPCM = 1, FormatFloat = 3, FormatExtensible = 0xfffe };
+	uint16_t format = 0, channels = 0, bits = 0;
+	uint32_t rate = 0;
+	bool have_format = false;
+	uint32_t data_size = 0;
+	for (;;) {
+		char header[8];
+		if (!file.read(header, 8)) return false;
+		uint32_t size = le32(header + 4);
+		if (std::memcmp(header, "fmt ", 4) == 0) {
+			//(16 bytes for PCM, up to 40 for WAVE_FORMAT_EXTENSIBLE; anything much larger is corrupt, so leave it to SDL)
+			if (size < 16 || size > 256) return false;
+			std::vector< char > fmt(size);
+			if (!file.read(fmt.data(), size)) return false;
+			format = le16(&fmt[0]);
+			channels = le16(&fmt[2]);
+			rate = le32(&fmt[4]);
+			bits = le16(&fmt[14]);
+			//extensible files keep the actual format at the start of their sub-format GUID:
+			if (format == FormatExtensible && size >= 26) format = le16(&fmt[24]);
+			have_format = true;
+		} else if (std::memcmp(header, "data", 4) == 0) {
+			if (!have_format) return false;
+			//streamed or truncated files often have a placeholder (e.g., 0xffffffff) or too-large size here,
+			// so don't trust it beyond the end of the file:
+			std::streampos start = file.tellg();
+			file.seekg(0, std::ios::end);
+			std::streampos end = file.tellg();
+			file.seekg(start);
+			if (start < 0 || end < start) return false;
+			data_size = uint32_t(std::min< std::streamoff >(size, end - start));
+			break;
+		} else {
+			file.seekg(size, std::ios::cur);
+		}
+		if (size & 1) file.seekg(1, std::ios::cur); //(chunks are padded to even sizes)
+	}
+
+	if (rate != AUDIO_RATE || (channels != 1 && channels != 2)) return false;
+	if (!((format == FormatPCM && bits == 16) || (format == FormatFloat && bits == 32))) return false;
+
+	//read the samples (into 'data' itself when they are already float mono), then convert to float mono in one pass:
+	uint32_t frame_bytes = channels * (bits / 8);
+	size_t frames = data_size / frame_bytes;
+	if (format == FormatFloat && channels == 1) {
+		data.resize(frames);
+		file.read(reinterpret_cast< char * >(data.data()), frames * sizeof(float));
+		data.resize(size_t(file.gcount()) / sizeof(float));
+	} else if (format == FormatFloat) {
+		std::vector< float > stereo(frames * 2);
+		file.read(reinterpret_cast< char * >(stereo.data()), stereo.size() * sizeof(float));
+		frames = size_t(file.gcount()) / frame_bytes;
+		data.resize(frames);
+		float const *src = stereo.data();
+		for (size_t i = 0; i < frames; ++i) {
+			data[i] = (src[2*i] + src[2*i+1]) * 0.5f;
+		}
+	} else {
+		std::vector< int16_t > samples(frames * channels);
+		file.read(reinterpret_cast< char * >(samples.data()), samples.size() * sizeof(int16_t));
+		frames = size_t(file.gcount()) / frame_bytes;
+		data.resize(frames);
+		int16_t const *src = samples.data();
+		if (channels == 1) {
+			constexpr float const Scale = 1.0f / 32768.0f;
+			for (size_t i = 0; i < frames; ++i) {
+				data[i] = src[i] * Scale;
+			}
+		} else {
+			constexpr float const Scale = 0.5f / 32768.0f;
+			for (size_t i = 0; i < frames; ++i) {
+				data[i] = (int32_t(src[2*i]) + int32_t(src[2*i+1])) * Scale;
+			}
+		}
+	}
+	return true;
+}
+
+//anything load_wav_direct doesn't handle is loaded and converted by SDL:
+static void load_wav_sdl(std::string const &filename, std::vector< float > *data_) {
 	auto &data = *data_;
 
 	SDL_AudioSpec audio_spec;
@@ -39,12 +140,23 @@ void load_wav(std::string const &filename, std::vector< float > *data_) {
 		data.assign(reinterpret_cast< float * >(audio_buf), reinterpret_cast< float * >(audio_buf + audio_len));
 	}
 	SDL_FreeWAV(audio_buf);
+}
+
+void load_wav(std::string const &filename, std::vector< float > *data_, bool report_range) {
+	assert(data_);
+	auto &data = *data_;
+
+	if (!load_wav_direct(filename, &data)) {
+		load_wav_sdl(filename, &data);
+	}
 
-	float min = 0.0f;
-	float max = 0.0f;
-	for (auto d : data) {
-		min = std::min(min, d);
-		max = std::max(max, d);
+	if (report_range) {
+		float min = 0.0f;
+		float max = 0.0f;
+		for (auto d : data) {
+			min = std::min(min, d);
+			max = std::max(max, d);
+		}
+		std::cout << "Range: " << min << ", " << max << std::endl;
 	}
-	std::cout << "Range: " << min << ", " << max << std::endl;
 }
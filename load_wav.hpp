@@ -4,4 +4,6 @@
 #include <vector>
 
 //Load a WAV file as 48kHz floating-point mono; throws on error:
-void load_wav(std::string const &filename, std::vector< float > *data);
+// (48kHz 16-bit or float, mono or stereo files are read directly; anything else is converted by SDL)
+// 'report_range' prints the smallest and largest sample values, which takes an extra pass over the data:
+void load_wav(std::string const &filename, std::vector< float > *data, bool report_range = false);
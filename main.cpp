@@ -9,6 +9,8 @@
 
 //For sound init:
 #include "Sound.hpp"
+#include "pcm_cache.hpp"
+#include "data_path.hpp"
 
 //GL.hpp will include a non-namespace-polluting set of opengl prototypes:
 #include "GL.hpp"
@@ -108,6 +110,9 @@ int main(int argc, char **argv) {
 	//------------ init sound --------------
 	Sound::init();
 
+	//decoded samples are cached next to the game, so later launches skip decoding:
+	set_pcm_cache_directory(data_path("pcm-cache"));
+
 	//------------ load assets --------------
 	call_load_functions();
 
@@ -167,8 +172,7 @@ int main(int argc, char **argv) {
 				else if (evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_r
 					&& std::dynamic_pointer_cast< GardenMode > (Mode::current)->is_game_over)
 				{
-					Mode::set_current(nullptr);
-					Mode::set_current(std::make_shared< GardenMode >());
+					std::dynamic_pointer_cast< GardenMode >(Mode::current)->restart();
 				}
 			}
 			if (!Mode::current) break;
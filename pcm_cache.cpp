@@ -0,0 +1,229 @@
+#include "pcm_cache.hpp"
+
+#include "read_write_chunk.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cassert>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static std::string cache_directory;
+
+void set_pcm_cache_directory(std::string const &directory) {
+	cache_directory = directory;
+	if (cache_directory.empty()) return;
+	std::error_code ec;
+	fs::create_directories(cache_directory, ec);
+	if (ec) {
+		std::cerr << "WARNING: cannot create sample cache directory '" << cache_directory << "' (" << ec.message() << "); not caching." << std::endl;
+		cache_directory.clear();
+	}
+}
+
+//contents of the "key0" chunk:
+struct PCMCacheKey {
+	uint64_t source_size = 0;
+	int64_t source_time = 0; //modification time (in the filesystem clock's native ticks)
+	uint32_t length = 0; //in samples
+	uint32_t padding = 0;
+};
+static_assert(sizeof(PCMCacheKey) == 24, "PCMCacheKey is packed");
+
+//same header write_chunk/read_chunk use:
+struct ChunkHeader {
+	char magic[4] = {'\0', '\0', '\0', '\0'};
+	uint32_t size = 0;
+};
+static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+
+//fill in the source-file part of the key; false if the source can't be examined:
+static bool source_key(std::string const &source, PCMCacheKey *key) {
+	std::error_code ec;
+	key->source_size = fs::file_size(source, ec);
+	if (ec) return false;
+	auto time = fs::last_write_time(source, ec);
+	if (ec) return false;
+	key->source_time = int64_t(time.time_since_epoch().count());
+	return true;
+}
+
+static std::string cache_path(std::string const &source, std::string const &magic) {
+	std::error_code ec;
+	fs::path absolute = fs::absolute(source, ec);
+	size_t hash = std::hash< std::string >{}((ec ? source : absolute.string()) + '|' + magic);
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.pcm", (unsigned long long)hash);
+	return (fs::path(cache_directory) / name).string();
+}
+
+static std::vector< char > padded_path(std::string const &source) {
+	std::vector< char > path(source.begin(), source.end());
+	path.resize((path.size() + 7) / 8 * 8, '\0');
+	return path;
+}
+
+//map all of 'path' read-only; returns null (and leaves *size alone) on failure:
+static std::shared_ptr< void const > map_file(std::string const &path, size_t *size) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return nullptr;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return nullptr;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping) return nullptr;
+	void const *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping); //(the view keeps the mapping open)
+	if (!view) return nullptr;
+	*size = size_t(file_size.QuadPart);
+	return std::shared_ptr< void const >(view, [](void const *v) {
+		UnmapViewOfFile(v);
+	});
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return nullptr;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+		close(fd);
+		return nullptr;
+	}
+	size_t file_size = size_t(info.st_size);
+	void *view = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); //(the mapping keeps the file open)
+	if (view == MAP_FAILED) return nullptr;
+	*size = file_size;
+	return std::shared_ptr< void const >(view, [file_size](void const *v) {
+		munmap(const_cast< void * >(v), file_size);
+	});
+#endif
+}
+
+//bring every page of [data, data+bytes) into memory now, so that the mixer is never the first to touch one
+// (a fault there would mean waiting on the disk inside the audio callback):
+static void prefault(char const *data, size_t bytes) {
+	if (bytes == 0) return;
+#ifndef _WIN32
+	//(lets the kernel read ahead, rather than faulting in one page at a time below)
+	size_t page = size_t(sysconf(_SC_PAGESIZE));
+	uintptr_t begin = uintptr_t(data) / page * page;
+	madvise(reinterpret_cast< void * >(begin), uintptr_t(data) + bytes - begin, MADV_WILLNEED);
+#endif
+	//touch one byte per page (4096 being no larger than any page size in use):
+	constexpr size_t const Step = 4096;
+	uint8_t sum = 0;
+	for (size_t at = 0; at < bytes; at += Step) {
+		sum += *reinterpret_cast< uint8_t const volatile * >(data + at);
+	}
+	sum += *reinterpret_cast< uint8_t const volatile * >(data + bytes - 1);
+	(void)sum;
+}
+
+bool load_pcm_cache(std::string const &source, std::string const &magic, PCMCacheEntry *entry) {
+	assert(entry);
+	assert(magic.size() == 4);
+	if (cache_directory.empty()) return false;
+
+	PCMCacheKey key;
+	if (!source_key(source, &key)) return false;
+
+	size_t size = 0;
+	std::shared_ptr< void const > mapping = map_file(cache_path(source, magic), &size);
+	if (!mapping) return false;
+
+	//walk the chunks in place (rather than with read_chunk, which would copy them):
+	char const *base = static_cast< char const * >(mapping.get());
+	size_t at = 0;
+	auto next_chunk = [&](char const *expected, char const **data, size_t *bytes) {
+		if (size - at < sizeof(ChunkHeader)) return false;
+		ChunkHeader header;
+		std::memcpy(&header, base + at, sizeof(header));
+		if (std::memcmp(header.magic, expected, 4) != 0) return false;
+		if (size - at - sizeof(ChunkHeader) < header.size) return false;
+		*data = base + at + sizeof(ChunkHeader);
+		*bytes = header.size;
+		at += sizeof(ChunkHeader) + header.size;
+		return true;
+	};
+
+	char const *data;
+	size_t bytes;
+
+	if (!next_chunk("key0", &data, &bytes) || bytes != sizeof(PCMCacheKey)) return false;
+	PCMCacheKey stored;
+	std::memcpy(&stored, data, sizeof(stored));
+	if (stored.source_size != key.source_size || stored.source_time != key.source_time) return false;
+
+	if (!next_chunk("str0", &data, &bytes)) return false;
+	std::vector< char > path = padded_path(source);
+	if (bytes != path.size() || std::memcmp(data, path.data(), bytes) != 0) return false; //(hash collision)
+
+	if (!next_chunk(magic.c_str(), &data, &bytes)) return false;
+
+	prefault(data, bytes);
+
+	entry->mapping = mapping;
+	entry->data = data;
+	entry->bytes = bytes;
+	entry->length = stored.length;
+	return true;
+}
+
+void save_pcm_cache(std::string const &source, std::string const &magic, uint32_t length, void const *data, size_t bytes) {
+	assert(magic.size() == 4);
+	if (cache_directory.empty()) return;
+	if (bytes > 0xffffffffULL) return; //(too big for a chunk)
+
+	PCMCacheKey key;
+	if (!source_key(source, &key)) return;
+	key.length = length;
+
+	//write to a temporary file and rename into place, so a crash can't leave a partial cache file:
+	std::string path = cache_path(source, magic);
+	std::string temp = path + ".tmp";
+	{
+		std::ofstream file(temp, std::ios::binary);
+		write_chunk("key0", std::vector< PCMCacheKey >(1, key), &file);
+		write_chunk("str0", padded_path(source), &file);
+
+		//(same layout as write_chunk, but without copying the data into a vector first)
+		ChunkHeader header;
+		std::memcpy(header.magic, magic.data(), 4);
+		header.size = uint32_t(bytes);
+		file.write(reinterpret_cast< char const * >(&header), sizeof(header));
+		file.write(reinterpret_cast< char const * >(data), bytes);
+
+		if (!file) {
+			std::cerr << "WARNING: failed to write sample cache file '" << temp << "'." << std::endl;
+			file.close();
+			std::error_code ec;
+			fs::remove(temp, ec);
+			return;
+		}
+	}
+	std::error_code ec;
+	fs::rename(temp, path, ec);
+	if (ec) {
+		std::cerr << "WARNING: failed to replace sample cache file '" << path << "' (" << ec.message() << ")." << std::endl;
+		fs::remove(temp, ec);
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+//On-disk cache of decoded sample data, so that warm starts can skip decoding entirely.
+//Each (source file, storage format) pair is cached as '<directory>/<hash>.pcm' in the read_write_chunk format:
+//  key0 - one PCMCacheKey (size and modification time of the source file, and sample count)
+//  str0 - source path, NUL-padded to a multiple of 8 bytes (so the data chunk stays aligned)
+//  <magic> - the sample data, in the storage format named by 'magic'
+//Entries are ignored (and later overwritten) once the source's size or modification time changes.
+//Cache files are memory-mapped rather than read (and paged in when loaded, so playback never waits on the disk).
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+//cache files go in 'directory' (created if needed); '' -- the default -- turns the cache off:
+void set_pcm_cache_directory(std::string const &directory);
+
+//a cache hit:
+struct PCMCacheEntry {
+	std::shared_ptr< void const > mapping; //the file stays mapped while this (or a copy) is held
+	void const *data = nullptr; //start of the data chunk
+	size_t bytes = 0; //size of the data chunk
+	uint32_t length = 0; //in samples
+};
+
+//look for 'source' cached with data chunk 'magic'; returns false on a miss (or when the cache is off):
+bool load_pcm_cache(std::string const &source, std::string const &magic, PCMCacheEntry *entry);
+
+//cache 'bytes' of data (stored in the format named by 'magic') for 'source':
+// (does nothing when the cache is off; failures are only warnings)
+void save_pcm_cache(std::string const &source, std::string const &magic, uint32_t length, void const *data, size_t bytes);
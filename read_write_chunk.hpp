@@ -4,6 +4,7 @@
 #include <vector>
 #include <stdexcept>
 #include <cassert>
+#include <cstring>
 
 //helper function that reads an array of structures preceded by a simple header:
 //Expected format:
@@ -63,3 +64,48 @@ void write_chunk(std::string const &magic, std::vector< T > const &from, std::os
 	to.write(reinterpret_cast< const char * >(&header), sizeof(header));
 	to.write(reinterpret_cast< const char * >(from.data()), from.size() * sizeof(T));
 }
+
+
+//the same format, appended to / read from a block of memory (e.g., a snapshot of game state):
+template< typename T >
+void write_chunk(std::string const &magic, std::vector< T > const &from, std::vector< char > *to_) {
+	assert(magic.size() == 4);
+	assert(to_);
+	auto &to = *to_;
+
+	uint32_t size = uint32_t(from.size() * sizeof(T));
+	size_t at = to.size();
+	to.resize(at + 8 + size);
+	std::memcpy(&to[at], magic.data(), 4);
+	std::memcpy(&to[at + 4], &size, 4);
+	if (size) std::memcpy(&to[at + 8], from.data(), size);
+}
+
+//reads the chunk starting at from[*at], and advances *at past it:
+template< typename T >
+void read_chunk(std::vector< char > const &from, size_t *at_, std::string const &magic, std::vector< T > *to_) {
+	assert(magic.size() == 4);
+	assert(at_);
+	assert(to_);
+	auto &at = *at_;
+	auto &to = *to_;
+
+	if (at > from.size() || from.size() - at < 8) {
+		throw std::runtime_error("Failed to read chunk header");
+	}
+	if (std::string(&from[at], 4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk");
+	}
+	uint32_t size;
+	std::memcpy(&size, &from[at + 4], 4);
+	if (size % sizeof(T) != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+	if (from.size() - at - 8 < size) {
+		throw std::runtime_error("Failed to read chunk data.");
+	}
+
+	to.resize(size / sizeof(T));
+	if (size) std::memcpy(to.data(), &from[at + 8], size);
+	at += 8 + size;
+}